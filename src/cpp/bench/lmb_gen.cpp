@@ -0,0 +1,157 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+using namespace std;
+
+// Writes a synthetic program to stdout, each stressing one thing as N grows:
+//
+//   depth N    a chain of N closures each calling the next, N frames deep
+//   wide N     closures capturing N variables, made 64 times
+//   reuse N    N iterations of a loop whose work is the same application
+//   fresh N    N iterations of a loop whose work never repeats
+//   output N   N bytes of output
+//   source N   N definitions, each using the last
+//
+// Numbers are Church numerals built by doubling, so source size is
+// O(log N) everywhere but in wide and source. Every program prints a
+// newline at the end.
+//
+//   lmb_gen WORKLOAD N > prog.lmb
+
+// numerals {{{
+
+string numeral(unsigned long n) {
+
+    string expr = "zero";
+    for (int k = 63; k >= 0; k--) {
+        if (n >> k == 0)
+            continue;
+        if (expr != "zero")
+            expr = "(dbl " + expr + ")";
+        if ((n >> k) & 1)
+            expr = "(succ " + expr + ")";
+    }
+    return expr;
+}
+
+// }}}
+
+// output {{{
+
+// c on __builtin_p0/p1; the innermost bit goes first, and each is applied
+// to a new closure, so none is a repeat of the last
+string print_char(int c) {
+
+    string expr = "(\\x x)";
+    for (int k = 7; k >= 0; k--)
+        expr = string("(__builtin_p") + char('0' + ((c >> k) & 1)) + " (wrap " + expr + "))";
+    return expr;
+}
+
+// c as the byte __builtin_putbyte takes: \f f b7 .. b0
+string byte(int c) {
+
+    string expr = "(\\f f";
+    for (int k = 7; k >= 0; k--)
+        expr += (c >> k) & 1 ? " T" : " F";
+    return expr + ")";
+}
+
+// }}}
+
+// workloads {{{
+
+string depth(unsigned long) {
+    return "N (\\k \\v k v) (\\v v) (\\x x)";
+}
+
+string wide(unsigned long n) {
+
+    string mk = "(";
+    for (unsigned long i = 0; i < n; i++)
+        mk += "\\x" + to_string(i) + " ";
+    mk += "\\y y";
+    for (unsigned long i = 0; i < n; i++)
+        mk += " x" + to_string(i);
+    mk += ")";
+
+    string step = "(\\s " + mk;
+    for (unsigned long i = 0; i < n; i++)
+        step += " s";
+    step += ")";
+
+    return numeral(64) + " " + step + " (\\x x)";
+}
+
+string reuse(unsigned long) {
+    return "N (\\s (\\r \\_ s) (work (\\x x))) (\\x x)";
+}
+
+string fresh(unsigned long) {
+    return "N (\\s work s) (\\x x)";
+}
+
+string output(unsigned long) {
+    return "N (\\s __builtin_putbyte " + byte('a') + " (\\_ s)) (\\x x)";
+}
+
+string source(unsigned long n) {
+
+    string expr = "let (\\x x) \\v0\n";
+    for (unsigned long i = 1; i <= n; i++)
+        expr += "  let (\\x v" + to_string(i - 1) + " x) \\v" + to_string(i) + "\n";
+    return expr + "  v" + to_string(n);
+}
+
+// }}}
+
+// main {{{
+
+int main(int argc, char *args[]) {
+
+    if (argc != 3) {
+        cerr << "usage: lmb_gen depth|wide|reuse|fresh|output|source N" << endl;
+        return 2;
+    }
+    string workload = args[1];
+    unsigned long n = strtoul(args[2], nullptr, 10);
+
+    string body;
+    if (workload == "depth")
+        body = depth(n);
+    else if (workload == "wide")
+        body = wide(n);
+    else if (workload == "reuse")
+        body = reuse(n);
+    else if (workload == "fresh")
+        body = fresh(n);
+    else if (workload == "output")
+        body = output(n);
+    else if (workload == "source")
+        body = source(n);
+    else {
+        cerr << "lmb_gen: unknown workload " << workload << endl;
+        return 2;
+    }
+
+    cout << "# lmb_gen " << workload << " " << n << "\n"
+         << "\n"
+         << "((\\let let (\\val \\body body val)) \\let\n"
+         << "\n"
+         << "  let (\\f \\x x) \\zero\n"
+         << "  let (\\n \\f \\x f (n f x)) \\succ\n"
+         << "  let (\\n \\f \\x n f (n f x)) \\dbl\n"
+         << "  let (\\t \\f t) \\T\n"
+         << "  let (\\t \\f f) \\F\n"
+         << "  let (\\x \\_ x) \\wrap\n"
+         << "  let (\\x " << numeral(16) << " wrap x) \\work\n"
+         << "  let " << numeral(n) << " \\N\n"
+         << "\n"
+         << "  (\\_ " << print_char('\n') << ") (\n"
+         << "  " << body << "\n"
+         << "  )\n"
+         << ")\n";
+}
+
+// }}}
@@ -0,0 +1,49 @@
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// Runs a command with stdin and stdout passed through, then prints its wall
+// time in seconds and peak RSS in KiB to stderr, tab separated. Exits as the
+// command did.
+//
+//   lmb_run CMD [ARGS...] < in > out 2> time
+
+int main(int argc, char *args[]) {
+
+    if (argc < 2) {
+        cerr << "usage: lmb_run CMD [ARGS...]" << endl;
+        return 2;
+    }
+
+    auto start = chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        cerr << "lmb_run: fork: " << strerror(errno) << endl;
+        return 1;
+    }
+    if (pid == 0) {
+        execvp(args[1], args + 1);
+        cerr << "lmb_run: can't run " << args[1] << ": " << strerror(errno) << endl;
+        _exit(127);
+    }
+
+    int status;
+    rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0)
+        if (errno != EINTR)
+            return 1;
+
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << wall << "\t" << usage.ru_maxrss << endl;
+
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,30 @@
+#include "micro.hpp"
+#include <cstdlib>
+#include <new>
+
+// Every allocation goes through here, so a benchmark can tell how many
+// its operations made. Replaced in a translation unit of its own, where
+// the compiler can't pair it up with the frees of inlined code.
+
+namespace micro {
+
+size_t allocs = 0;
+size_t alloc_bytes = 0;
+
+}
+
+void* operator new(std::size_t size) {
+    ++micro::allocs;
+    micro::alloc_bytes += size;
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
@@ -0,0 +1,94 @@
+#ifndef __MICRO_H__
+#define __MICRO_H__
+
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstdint>
+
+// Harness of the micro_* benchmarks, linked with micro.cpp
+
+namespace micro {
+
+// counted by the operator new of micro.cpp
+extern size_t allocs;
+extern size_t alloc_bytes;
+
+// xorshift64*, the same numbers on every run
+struct rng_t {
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    uint64_t operator()() {
+        x ^= x >> 12, x ^= x << 25, x ^= x >> 27;
+        return x * 0x2545f4914f6cdd1dull;
+    }
+};
+
+// cnt indices below n, index k drawn with weight 1/(k+1): a few closures
+// and exprs take most of the lookups, as in real programs
+inline std::vector<size_t> zipf(size_t n, size_t cnt) {
+
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (size_t k = 0; k < n; k++)
+        cdf[k] = sum += 1.0 / (k + 1);
+
+    rng_t rng;
+    std::vector<size_t> retv(cnt);
+    for (auto &idx : retv) {
+        double u = double(rng() >> 11) / double(1ull << 53) * sum;
+        idx = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        if (idx >= n)
+            idx = n - 1;
+    }
+    return retv;
+}
+
+// Calls prepare, untimed, then batch, which does ops operations, until
+// batches took min_sec; prints the time and allocations per operation.
+inline void run(const std::string &name, size_t ops, std::function<void()> prepare, std::function<void()> batch, double min_sec = 0.2) {
+
+    using clock = std::chrono::steady_clock;
+
+    double sec = 0;
+    size_t total = 0, nallocs = 0, nbytes = 0;
+    while (sec < min_sec) {
+        prepare();
+        size_t allocs0 = allocs, bytes0 = alloc_bytes;
+        auto start = clock::now();
+        batch();
+        sec += std::chrono::duration<double>(clock::now() - start).count();
+        nallocs += allocs - allocs0;
+        nbytes += alloc_bytes - bytes0;
+        total += ops;
+    }
+
+    std::cout << std::left << std::setw(32) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(1) << sec * 1e9 / total << " ns/op"
+              << std::setw(10) << std::setprecision(2) << double(nallocs) / total << " allocs/op"
+              << std::setw(10) << std::setprecision(1) << double(nbytes) / total << " B/op"
+              << std::endl;
+}
+
+// keeps the compiler from dropping a result
+template <typename T>
+inline void keep(const T &val) {
+    asm volatile("" : : "g"(&val) : "memory");
+}
+
+// names given on the command line, or all
+inline bool wanted(int argc, char *args[], const std::string &name) {
+    if (argc < 2)
+        return true;
+    for (int i = 1; i < argc; i++)
+        if (name.compare(0, std::string(args[i]).size(), args[i]) == 0)
+            return true;
+    return false;
+}
+
+}
+
+#endif
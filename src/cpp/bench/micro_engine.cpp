@@ -0,0 +1,146 @@
+// The interpreter's internals are all in its one translation unit, so the
+// benchmarks are compiled into it.
+#include "../interpreter/lib/engine.cpp"
+#include "micro.hpp"
+
+// Microbenchmarks of what the interpreter spends its time in, on closure
+// ids and exprs drawn the way programs draw them (see micro::zipf).
+//
+//   micro_engine [NAME-PREFIX...]
+
+int main(int argc, char *args[]) {
+
+    engine_t engine;
+    use_t use(*engine.st);
+
+    const size_t N = 1 << 16;
+    const auto picks = micro::zipf(N, N);
+
+    // closures with their own bodies, ids in allocation order as they
+    // are in a run
+    vector<lmb_hdr_t> pool;
+    for (size_t k = 0; k < 2 * N; k++)
+        pool.push_back(make_lmb(&engine.st->exprs[ref_expr(k)], env_t{}));
+
+    // hash_map_t {{{
+
+    // as eval_cache, keyed on ids of live closures; a miss inserts, into
+    // a table with room to spare, where insert starts from an empty one
+    // and grows it
+    using memo_map_t = hash_map_t<lmb_idx_t, memo_t, hash<lmb_idx_t>, memo_stale_t>;
+    unique_ptr<memo_map_t> memo;
+
+    auto preloaded = [&]() {
+        memo.reset(new memo_map_t());
+        memo->_rehash(8 * N);
+        for (size_t k = 0; k < N; k++)
+            (*memo)[pool[k]->idx].val = pool[k];
+    };
+
+    if (micro::wanted(argc, args, "hash_map_t::[] hit"))
+        micro::run("hash_map_t::[] hit", N, [&]() { if (!memo) preloaded(); }, [&]() {
+            for (auto k : picks)
+                micro::keep((*memo)[pool[k]->idx]);
+        });
+    memo.reset();
+
+    if (micro::wanted(argc, args, "hash_map_t::[] miss"))
+        micro::run("hash_map_t::[] miss", N, preloaded, [&]() {
+            for (size_t k = N; k < 2 * N; k++)
+                micro::keep((*memo)[pool[k]->idx]);
+        });
+    memo.reset();
+
+    if (micro::wanted(argc, args, "hash_map_t::[] insert"))
+        micro::run("hash_map_t::[] insert", N, [&]() { memo.reset(new memo_map_t()); }, [&]() {
+            for (size_t k = 0; k < N; k++)
+                micro::keep((*memo)[pool[k]->idx]);
+        });
+    memo.reset();
+
+    // }}}
+
+    // make_expr {{{
+
+    // applications of refs: a hit finds one made before, new ones chain
+    // on the last, as the parser does down a long program
+    const size_t R = 256, E = 1024;
+    vector<expr_id_t> refs;
+    for (size_t k = 0; k < R; k++)
+        refs.push_back(ref_expr(k));
+
+    if (micro::wanted(argc, args, "make_expr hit"))
+        micro::run("make_expr hit", N, [&]() {
+            for (size_t k = 0; k < N; k++)
+                apply_expr(refs[picks[k] % R], refs[picks[k] / R % R]);
+        }, [&]() {
+            for (auto k : picks)
+                micro::keep(apply_expr(refs[k % R], refs[k / R % R]));
+        });
+
+    // each batch from a root of its own
+    expr_id_t chain;
+    size_t roots = R;
+    if (micro::wanted(argc, args, "make_expr new"))
+        micro::run("make_expr new", E, [&]() { chain = ref_expr(roots++); }, [&]() {
+            for (size_t k = 0; k < E; k++)
+                chain = apply_expr(chain, refs[picks[k] % R]);
+        });
+
+    // }}}
+
+    // eval of a \ {{{
+
+    // \ capturing three closures: reuse finds the closure made for the
+    // same env before, new makes it
+    auto lexpr = lmb_expr(refs[1], arg_map_t{0, 1, 2});
+    vector<env_t> envs(N);
+    for (size_t k = 0; k < N; k++)
+        envs[k] = env_t{pool[picks[k] % 64], pool[picks[(k + 1) % N] % 64]};
+
+    if (micro::wanted(argc, args, "eval lmb reuse"))
+        micro::run("eval lmb reuse", N, [&]() {
+            for (size_t k = 0; k < N; k++)
+                eval(lexpr, shadow_env_t{pool[picks[k] % E], envs[k]});
+        }, [&]() {
+            for (size_t k = 0; k < N; k++)
+                micro::keep(eval(lexpr, shadow_env_t{pool[picks[k] % E], envs[k]}));
+        });
+
+    vector<lmb_hdr_t> fresh;
+    if (micro::wanted(argc, args, "eval lmb new"))
+        micro::run("eval lmb new", E, [&]() {
+            fresh.clear();
+            for (size_t k = 0; k < E; k++)
+                fresh.push_back(make_lmb(&engine.st->exprs[refs[0]], env_t{}));
+        }, [&]() {
+            for (size_t k = 0; k < E; k++)
+                micro::keep(eval(lexpr, shadow_env_t{fresh[k], envs[k]}));
+        });
+
+    // }}}
+
+    // tokenizer_t::pop {{{
+
+    // definitions as lmb_gen writes them
+    string src;
+    for (size_t k = 0; k < 4096; k++)
+        src += "  let (\\x \\y x (y v" + to_string(k) + ")) \\v" + to_string(k + 1) + "\n";
+    size_t ntoks = 0;
+    {
+        istringstream stm(src);
+        tokenizer_t toks(stm);
+        for (; toks.peak() != ""; ntoks++)
+            toks.pop();
+    }
+
+    unique_ptr<istringstream> stm;
+    if (micro::wanted(argc, args, "tokenizer_t::pop"))
+        micro::run("tokenizer_t::pop", ntoks, [&]() { stm.reset(new istringstream(src)); }, [&]() {
+            tokenizer_t toks(*stm);
+            while (toks.peak() != "")
+                toks.pop();
+        });
+
+    // }}}
+}
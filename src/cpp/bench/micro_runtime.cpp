@@ -0,0 +1,98 @@
+#include "runtime.hpp"
+#include "micro.hpp"
+#include <vector>
+
+// Microbenchmarks of runtime.hpp, what every transpiled program is built
+// on, with closures drawn the way programs draw them (see micro::zipf).
+//
+//   micro_runtime [NAME-PREFIX...]
+
+// shaped like lmb_c's output: _pair_t applied to b makes \f f a b
+struct _apply_t : public lmb_t {
+    env_t<2> _e;
+    _apply_t(const env_t<2> &__e) : _e(__e) {}
+    virtual lmb_hdr_t exec(const lmb_hdr_t &_a) const {
+        return _a->cached_exec(_e[0])->cached_exec(_e[1]);
+    }
+};
+
+struct _pair_t : public lmb_t {
+    env_t<1> _e;
+    _pair_t(const env_t<1> &__e) : _e(__e) {}
+    virtual lmb_hdr_t exec(const lmb_hdr_t &_a) const {
+        return make_lmb<_apply_t>(env_t<2>{{_e[0], _a}});
+    }
+};
+
+struct _leaf_t : public lmb_t {
+    size_t k;
+    _leaf_t(size_t _k) : k(_k) {}
+    virtual lmb_hdr_t exec(const lmb_hdr_t &_a) const {
+        return _a;
+    }
+};
+
+int main(int argc, char *args[]) {
+
+    const size_t N = 1 << 16;
+    const auto picks = micro::zipf(N, N);
+
+    vector<lmb_hdr_t> pool;
+    for (size_t k = 0; k < 2 * N; k++)
+        pool.push_back(make_lmb<_leaf_t>(size_t(k)));
+
+    // make_lmb {{{
+
+    // a hit finds the closure for the same env, new ones capture a closure
+    // never captured before
+    const size_t E = 256;
+    if (micro::wanted(argc, args, "make_lmb hit"))
+        micro::run("make_lmb hit", N, [&]() {
+            for (auto k : picks)
+                make_lmb<_apply_t>(env_t<2>{{pool[k % E], pool[k / E % E]}});
+        }, [&]() {
+            for (auto k : picks)
+                micro::keep(make_lmb<_apply_t>(env_t<2>{{pool[k % E], pool[k / E % E]}}));
+        });
+
+    // made with new_lmb, so none was captured yet
+    vector<lmb_hdr_t> fresh;
+    auto renew = [&]() {
+        fresh.clear();
+        for (size_t k = 0; k < E; k++)
+            fresh.push_back(new_lmb<_leaf_t>(k));
+    };
+
+    if (micro::wanted(argc, args, "make_lmb new"))
+        micro::run("make_lmb new", E, renew, [&]() {
+            for (auto &lmb : fresh)
+                micro::keep(make_lmb<_pair_t>(env_t<1>{{lmb}}));
+        });
+
+    // }}}
+
+    // cached_exec {{{
+
+    // \f f a b applied: a hit is one lookup, a miss runs exec and the
+    // applications it makes
+    vector<lmb_hdr_t> pairs;
+    for (size_t k = 0; k < E; k++)
+        pairs.push_back(make_lmb<_apply_t>(env_t<2>{{pool[k], pool[k + 1]}}));
+
+    if (micro::wanted(argc, args, "cached_exec hit"))
+        micro::run("cached_exec hit", N, [&]() {
+            for (auto k : picks)
+                pairs[k % E]->cached_exec(pool[k]);
+        }, [&]() {
+            for (auto k : picks)
+                micro::keep(pairs[k % E]->cached_exec(pool[k]));
+        });
+
+    if (micro::wanted(argc, args, "cached_exec miss"))
+        micro::run("cached_exec miss", E, renew, [&]() {
+            for (auto &lmb : fresh)
+                micro::keep(pairs[0]->cached_exec(lmb));
+        });
+
+    // }}}
+}
@@ -0,0 +1,95 @@
+#!/bin/bash
+# sweep.sh [--prog] WORKLOAD [N...]
+# runs lmb_gen's WORKLOAD at each N (256 to 4096 by default) on lmb, and
+# with --prog on the transpiled program too, after checking both print the
+# same; prints time and peak RSS against N with the log-log slope since the
+# last N, so anything past linear (slope well over 1) stands out. The table
+# is kept in $OUT/WORKLOAD.tsv, and plotted to $OUT/WORKLOAD.png when
+# gnuplot is around.
+set -u
+BENCH=$(cd "$(dirname "$0")" && pwd)
+LMB=${LMB:-$BENCH/../interpreter/build/lmb}
+TRANSPILE=$BENCH/../transpile
+OUT=${OUT:-$(mktemp -d)}
+ulimit -s unlimited
+
+prog=
+if [ "${1:-}" = --prog ]; then
+    prog=1
+    shift
+fi
+if [ $# -lt 1 ]; then
+    echo "usage: sweep.sh [--prog] depth|wide|reuse|fresh|output|source [N...]" >&2
+    exit 2
+fi
+workload=$1
+shift
+[ $# -gt 0 ] || set -- 256 512 1024 2048 4096
+
+make -s -C "$BENCH" || exit 1
+[ -z "$prog" ] || make -s -C "$TRANSPILE" || exit 1
+mkdir -p "$OUT"
+tsv=$OUT/$workload.tsv
+
+# name N cmd... appends "name N seconds rss" to the table
+measure() {
+    local name=$1 n=$2 stat
+    shift 2
+    if ! stat=$("$BENCH/build/lmb_run" "$@" < /dev/null 2>&1 > "$OUT/$workload.$n.$name.out"); then
+        echo "$name failed at N=$n" >&2
+        exit 1
+    fi
+    printf '%s\t%s\t%s\n' "$name" "$n" "$(tail -1 <<< "$stat")" >> "$tsv"
+}
+
+printf 'engine\tN\tseconds\trss_kb\n' > "$tsv"
+for n in "$@"; do
+    src=$OUT/$workload.$n.lmb
+    "$BENCH/build/lmb_gen" "$workload" "$n" > "$src" || exit 1
+    measure lmb "$n" "$LMB" "$src"
+    [ -n "$prog" ] || continue
+    make -s -C "$TRANSPILE" "$OUT/$workload.$n" > /dev/null || exit 1
+    measure prog "$n" "$OUT/$workload.$n"
+    if ! cmp -s "$OUT/$workload.$n.lmb.out" "$OUT/$workload.$n.prog.out"; then
+        echo "outputs differ at N=$n" >&2
+        exit 1
+    fi
+done
+
+awk -F '\t' '
+    NR == 1 { next }
+    { name[NR] = $1; n[NR] = $2; t[NR] = $3; rss[NR] = $4; if ($3 > tmax) tmax = $3 }
+    function slope(a, b, na, nb) { return a > 0 && b > 0 ? log(b / a) / log(nb / na) : 0 }
+    END {
+        printf "%-6s %10s %10s %6s %10s %6s\n", "engine", "N", "seconds", "slope", "rss_kb", "slope"
+        for (i = 2; i <= NR; i++) {
+            st = sr = ""
+            if (last[name[i]]) {
+                j = last[name[i]]
+                st = sprintf("%6.2f", slope(t[j], t[i], n[j], n[i]))
+                sr = sprintf("%6.2f", slope(rss[j], rss[i], n[j], n[i]))
+            }
+            bar = ""
+            for (k = 0; k < (tmax > 0 ? 30 * t[i] / tmax : 0); k++)
+                bar = bar "#"
+            printf "%-6s %10d %10.4f %6s %10d %6s %s\n", name[i], n[i], t[i], st, rss[i], sr, bar
+            last[name[i]] = i
+        }
+    }' "$tsv"
+
+if command -v gnuplot > /dev/null; then
+    gnuplot <<EOF
+set terminal png size 960,480
+set output "$OUT/$workload.png"
+set multiplot layout 1,2 title "$workload"
+set logscale xy
+set xlabel "N"
+set key left top
+set ylabel "seconds"
+plot for [e in "lmb prog"] "< grep '^".e."\t' $tsv" using 2:3 with linespoints title e
+set ylabel "peak RSS (KiB)"
+plot for [e in "lmb prog"] "< grep '^".e."\t' $tsv" using 2:4 with linespoints title e
+unset multiplot
+EOF
+fi
+echo "results in $OUT" >&2
@@ -0,0 +1,125 @@
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include <functional>
+#include <iostream>
+#include <memory>
+
+// One interpreter instance. Everything it evaluates (exprs, closures, memo
+// tables, I/O state) belongs to it, so a process can host any number of
+// them, each used by one thread at a time.
+struct engine_t {
+
+    // how a run ended: all done, or abandoned at a limit (see limits())
+    enum status_t {
+        DONE,
+        BUDGET,
+        MEMORY,
+        TIMEOUT,
+        STACK,
+        SUSPENDED,
+    };
+
+    // what getc returns when no byte is there yet, see start()
+    static const int AGAIN = -2;
+
+    // next input byte (or EOF), and one output byte
+    using getc_t = std::function<int()>;
+    using putc_t = std::function<void(int)>;
+
+    struct state_t;
+    std::unique_ptr<state_t> st;
+
+    // bound to stdin / stdout until bind() says otherwise
+    engine_t();
+    ~engine_t();
+
+    engine_t(const engine_t&) = delete;
+    engine_t& operator=(const engine_t&) = delete;
+
+    // parse every top level expression; false if one uses an unknown name
+    // (those before it are kept)
+    bool load(std::istream &src);
+    void bind(getc_t getc, putc_t putc);
+
+    // evaluate the loaded program, giving up after budget applications
+    // (0 for the limits() one); a run stopped at a limit is abandoned, and
+    // the engine keeps answering the same until reset()
+    status_t run(size_t budget=0);
+
+    // what each run may use, 0 for no limit: applications (BUDGET), MB
+    // resident in the process (MEMORY) and seconds (TIMEOUT). Running out
+    // of stack stops a run too (STACK), instead of crashing. Steps and the
+    // stack are checked on every application, the others every thousand
+    // or so, so they may be overshot by that much. A run suspended waiting
+    // for input (see start()) isn't using its time; one resumed after
+    // waiting idle seconds or more is stopped with TIMEOUT.
+    void limits(size_t max_steps, size_t max_heap_mb, double timeout, double idle=0);
+
+    // run() on a stack of its own, so it can stop halfway: when getc
+    // returns AGAIN the run is suspended, and start() or resume() return
+    // SUSPENDED; resume() goes on from there, asking getc again. Until the
+    // run is over, the engine is only resumed. Any number of engines can
+    // be suspended at once on one thread, none knows of the others.
+    status_t start(size_t budget=0);
+    status_t resume();
+
+    // forget the effects of the last run, keeping pure results, so the
+    // program can run again on another input; and sync the memo file
+    void reset();
+
+    // once after top level expressions have run (all of them by default),
+    // write the heap to path; those read input are kept to run again
+    void snapshot(const char *path, size_t after=size_t(-1));
+    // start from a snapshot, before load() adds expressions of its own
+    bool restore(const char *path);
+
+    // call-by-need for arguments that can't reach a builtin: those are
+    // evaluated the first time the callee uses them, if ever. Output is the
+    // same as without. Memo files and snapshots record closures only, they
+    // can't be used with it.
+    void lazy();
+
+    // apply closures one argument at a time, the way they are written;
+    // by default a call site passes all its arguments to a lambda taking
+    // as many at once, without making the partial applications
+    void curried();
+
+    // 0 keeps the default threshold
+    void gc(size_t threshold=0);
+
+    // pure results are appended to the memo file on reset(), when it's
+    // closed, or when the engine is destroyed; reset() also picks up what
+    // other processes appended since
+    bool open_memo_file(const char *path, size_t min_steps);
+    void close_memo_file();
+
+    // memo tables are left out, per lambda body, where their hits save too
+    // little work; what was learned can be kept in a file (fingerprints of
+    // the bodies, one per line) to start from next time, or for lmb_c
+    // --memo-policy. A missing file is an empty policy.
+    bool read_memo_policy(const char *path);
+    bool write_memo_policy(const char *path) const;
+
+    void print_stats(std::ostream &os) const;
+    void print_hash_stats(std::ostream &os) const;
+
+    // bytes held by closures, their envs and memo tables, and lmb_cache
+    // tables, per lambda body, the top ones first
+    void print_heap_report(std::ostream &os, size_t top=20) const;
+    // print_heap_report at the next application after each
+    // request_heap_report(), which is async-signal-safe
+    void heap_report_on_request(std::ostream &os, size_t top=20);
+    static void request_heap_report();
+
+    // JSON lines of counters while running: applications, closures made
+    // and live, memo table entries and hits, bytes in and out, with rates
+    // since the line before. One every interval seconds (0 for none) and
+    // one at the end of each run. Without it, runs aren't checked for them.
+    void metrics(std::ostream &os, double interval=0);
+    // a line at the next application, to metrics()' stream or else stderr;
+    // async-signal-safe
+    static void request_metrics();
+};
+
+#endif
@@ -0,0 +1,2867 @@
+#include "engine.hpp"
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <deque>
+#include <map>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <iomanip>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+using namespace std;
+
+// hash_map_t {{{
+
+template <typename E>
+struct never_stale_t {
+    bool any() { return false; }
+    bool operator()(const E&) const { return false; }
+};
+
+// S tells entries that can never be looked up again; they're dropped
+// instead of being carried over whenever the table would have to grow,
+// if S::any says there may be new ones since it was last asked
+template <typename K, typename V, typename H=hash<K>, typename S=never_stale_t<pair<K, V>>>
+struct hash_map_t {
+
+    H hasher;
+    S stale;
+    size_t size;
+    vector<pair<size_t, unique_ptr<pair<K, V>>>> table;
+
+    hash_map_t() : size(0), table(1) {}
+
+    template <class KU>
+    V& operator[](KU&& k) {
+
+        size_t idx;
+        const size_t hash_val = hasher(k);
+        const size_t mask = table.size() - 1;
+
+        // exist?
+        for (idx = hash_val & mask; table[idx].second; idx = (idx + 1) & mask)
+            if (table[idx].first == hash_val && table[idx].second->first == k)
+                return table[idx].second->second;
+
+        // insert
+        ++size;
+        table[idx] = move(make_pair(hash_val, unique_ptr<pair<K, V>>(new pair<K, V>(forward<KU>(k), V()))));
+        V& retv = table[idx].second->second;
+
+        // extend if load >= 2/3
+        if (size * 3 >= table.size() * 2) {
+            vector<unique_ptr<pair<K, V>>> dropped;
+            if (stale.any())
+                erase_if(stale, dropped, false);
+            _rehash(size * 3 >= table.size() ? table.size() * 2 : table.size());
+        }
+
+        return retv;
+    }
+
+    // the value of k, nullptr if there is none; never inserts
+    V* find(const K &k) {
+
+        const size_t hash_val = hasher(k);
+        const size_t mask = table.size() - 1;
+
+        for (size_t idx = hash_val & mask; table[idx].second; idx = (idx + 1) & mask)
+            if (table[idx].first == hash_val && table[idx].second->first == k)
+                return &table[idx].second->second;
+        return nullptr;
+    }
+
+    // move entries matching pred out to dropped, then shrink to fit
+    template <typename P, typename D>
+    void erase_if(P pred, D &dropped, bool shrink=true) {
+
+        const size_t osize = size;
+        for (auto &ent : table)
+            if (ent.second && pred(*ent.second)) {
+                dropped.push_back(move(ent.second));
+                --size;
+            }
+        if (size == osize || !shrink)
+            return;
+
+        size_t cap = 1;
+        while (size * 3 >= cap * 2)
+            cap *= 2;
+        _rehash(cap);
+    }
+
+    void _rehash(size_t cap) {
+
+        decltype(table) ntable(cap);
+        const size_t nmask = ntable.size() - 1;
+
+        for (auto &ent : table)
+            if (ent.second) {
+                size_t idx = ent.first & nmask;
+                while (ntable[idx].second)
+                    idx = (idx + 1) & nmask;
+                ntable[idx] = move(ent);
+            }
+
+        table.swap(ntable);
+    }
+};
+
+// 64 bit finalizer (murmur3 / splitmix style), every input bit affects
+// every output bit
+static inline uint64_t _mix64(uint64_t x) {
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    x ^= x >> 32;
+    return x;
+}
+
+template <typename T>
+static inline size_t _hash_words(const T *p, size_t n) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL * (n + 1);
+    for (size_t i = 0; i < n; i++)
+        h = _mix64(h ^ p[i]);
+    return h;
+}
+
+// structural fingerprint; never 0, which stands for "not computed yet"
+static inline uint64_t _fingerprint(const vector<uint64_t> &words) {
+    uint64_t fp = _hash_words(words.data(), words.size());
+    return fp ? fp : 1;
+}
+
+namespace std {
+
+    // keys of parse time tables and of memo_file_t's index; evaluation
+    // hashes closure ids and env keys, which don't go through it
+    static inline size_t _combine(size_t a, size_t b) {
+        return _mix64(a * 0x9e3779b97f4a7c15ULL + b);
+    }
+
+    template <typename U, typename V>
+    struct hash<pair<U, V>> {
+        hash<U> uhash;
+        hash<V> vhash;
+        size_t operator()(const pair<U, V> &p) const {
+            return _combine(uhash(p.first), vhash(p.second));
+        }
+    };
+
+    template <typename T, size_t idx=tuple_size<T>::value>
+    struct _tuple_hash {
+        _tuple_hash<T, idx-1> uhash;
+        hash<typename tuple_element<idx-1, T>::type> vhash;
+        size_t operator()(const T& t) const {
+            return _combine(uhash(t), vhash(get<idx-1>(t)));
+        }
+    };
+    template <typename T>
+    struct _tuple_hash<T, 0> {
+        size_t operator()(const T&) const { return 0; }
+    };
+    template <typename... Args>
+    struct hash<tuple<Args...>> : _tuple_hash<tuple<Args...>> {};
+
+    template <typename V>
+    struct hash<vector<V>> {
+        hash<V> vhash;
+        size_t operator()(const vector<V> &vs) const {
+            size_t retv = 0;
+            for (auto &v : vs)
+                retv = _combine(retv, vhash(v));
+            return retv;
+        }
+    };
+}
+
+// Probe lengths and load of a family of tables, gathered by walking the
+// slots at exit so lookups pay nothing for it.
+struct hash_stats_t {
+
+    size_t tables = 0, entries = 0, slots = 0;
+    size_t probe_total = 0, probe_max = 0;
+
+    // any table of (hash, entry) slots probed linearly from hash & mask
+    template <typename T>
+    void add(const vector<T> &table) {
+
+        const size_t mask = table.size() - 1;
+        ++tables;
+        slots += table.size();
+
+        for (size_t idx = 0; idx < table.size(); idx++)
+            if (table[idx].second) {
+                size_t probe = ((idx - table[idx].first) & mask) + 1;
+                ++entries;
+                probe_total += probe;
+                probe_max = max(probe_max, probe);
+            }
+    }
+
+    void print(ostream &os, const char *name) const {
+        os << name << ": " << tables << " tables, " << entries << " entries, load "
+             << (slots ? double(entries) / slots : 0) << ", probe "
+             << (entries ? double(probe_total) / entries : 0) << " mean, " << probe_max << " max" << endl;
+    }
+};
+
+// One expression, 12 bytes in an array of them where children come before
+// their parents, so eval walks plain indices and the DAG is written out
+// in order.
+//
+//   LMB      a body, b arg_map offset in heap_t::arg_maps, len arg_map size
+//   APPLY    a func, b arg, len args on its spine, see eval_call
+//   REF      a index in the env
+//   the builtins take their arguments from the env
+using expr_id_t = uint32_t;
+enum expr_kind_t : uint8_t { LMB, APPLY, REF, P0, P1, G, GETBYTE, PUTBYTE };
+struct node_t {
+    uint32_t kind : 8;
+    uint32_t len : 24;
+    uint32_t a, b;
+};
+
+// }}}
+
+// lmb_t env_t expr_t {{{
+
+struct lmb_t;
+using lmb_idx_t = unsigned long;
+using lmb_hdr_t = shared_ptr<const lmb_t>;
+
+using env_t = vector<lmb_hdr_t>;
+
+struct shadow_env_t {
+    const lmb_hdr_t &shadow_val;
+    const env_t &orgi_env;
+    const lmb_hdr_t& operator[](int idx) const {
+        return idx == 0 ? shadow_val : orgi_env[idx-1];
+    }
+};
+
+// env_cache_t {{{
+
+// Probe key of lmb_cache: the ids of the captured closures, inline for
+// the usual small envs so probing doesn't allocate.
+struct env_key_t {
+
+    static const size_t inline_cap = 4;
+
+    size_t len;
+    lmb_idx_t small[inline_cap];
+    vector<lmb_idx_t> large;
+
+    explicit env_key_t(size_t cap) : len(0) {
+        if (cap > inline_cap)
+            large.resize(cap);
+    }
+
+    const lmb_idx_t* data() const {
+        return large.empty() ? small : large.data();
+    }
+
+    void push_back(lmb_idx_t idx) {
+        (large.empty() ? small : large.data())[len++] = idx;
+    }
+};
+
+// the most arguments taken at once, see eval_call; with the callee they
+// fit an env_key_t without allocating
+static const size_t max_call_args = env_key_t::inline_cap - 1;
+
+// lmb_cache: env ids -> closure. Same probing as hash_map_t, but stored
+// keys are packed into one arena per table instead of a vector each.
+// Keys are fully mixed, which costs bf-dsl a sixth of its time over the
+// old a*17+b: that put the closures one site makes in a row in adjacent
+// slots. Adding the last id unmixed kept it, but fcrh's runs of them
+// merged into clusters of thousands of slots.
+struct env_cache_t {
+
+    struct ent_t {
+        size_t off;
+        size_t len;
+        lmb_hdr_t val;
+    };
+    using ent_hdr_t = unique_ptr<ent_t>;
+
+    size_t size;
+    vector<lmb_idx_t> arena;
+    vector<pair<size_t, ent_hdr_t>> table;
+
+    env_cache_t() : size(0), table(1) {}
+
+    const lmb_idx_t* key(const ent_t &ent) const {
+        return arena.data() + ent.off;
+    }
+
+    lmb_hdr_t* find(const env_key_t &k) {
+
+        const size_t hash_val = _hash_words(k.data(), k.len);
+        const size_t mask = table.size() - 1;
+
+        for (size_t idx = hash_val & mask; table[idx].second; idx = (idx + 1) & mask) {
+            const ent_t &ent = *table[idx].second;
+            if (table[idx].first == hash_val && ent.len == k.len && equal(k.data(), k.data() + k.len, key(ent)))
+                return &table[idx].second->val;
+        }
+        return nullptr;
+    }
+
+    lmb_hdr_t& operator[](const env_key_t &k) {
+
+        size_t idx;
+        const size_t hash_val = _hash_words(k.data(), k.len);
+        const size_t mask = table.size() - 1;
+
+        // exist?
+        for (idx = hash_val & mask; table[idx].second; idx = (idx + 1) & mask) {
+            const ent_t &ent = *table[idx].second;
+            if (table[idx].first == hash_val && ent.len == k.len && equal(k.data(), k.data() + k.len, key(ent)))
+                return table[idx].second->val;
+        }
+
+        // insert
+        ++size;
+        table[idx] = make_pair(hash_val, ent_hdr_t(new ent_t{arena.size(), k.len, nullptr}));
+        arena.insert(arena.end(), k.data(), k.data() + k.len);
+        lmb_hdr_t &retv = table[idx].second->val;
+
+        // extend if load >= 2/3
+        if (size * 3 >= table.size() * 2)
+            _rehash(table.size() * 2);
+
+        return retv;
+    }
+
+    template <typename P, typename D>
+    void erase_if(P pred, D &dropped) {
+
+        const size_t osize = size;
+        for (auto &ent : table)
+            if (ent.second && pred(*ent.second)) {
+                dropped.push_back(move(ent.second));
+                --size;
+            }
+        if (size == osize)
+            return;
+
+        size_t cap = 1;
+        while (size * 3 >= cap * 2)
+            cap *= 2;
+        _rehash(cap);
+
+        // repack the arena without the keys of erased entries
+        decltype(arena) narena;
+        narena.reserve(arena.size());
+        for (auto &ent : table)
+            if (ent.second) {
+                const lmb_idx_t *k = key(*ent.second);
+                ent.second->off = narena.size();
+                narena.insert(narena.end(), k, k + ent.second->len);
+            }
+        arena.swap(narena);
+    }
+
+    void _rehash(size_t cap) {
+
+        decltype(table) ntable(cap);
+        const size_t nmask = ntable.size() - 1;
+
+        for (auto &ent : table)
+            if (ent.second) {
+                size_t idx = ent.first & nmask;
+                while (ntable[idx].second)
+                    idx = (idx + 1) & nmask;
+                ntable[idx] = move(ent);
+            }
+
+        table.swap(ntable);
+    }
+};
+
+// }}}
+
+// Whether memoizing applications of a body's closures pays, decided anew
+// every window of them from the steps their hits saved: off when that's
+// under an eighth of the applications made, on again from a quarter. While
+// off, one application in sample is still memoized, so repeats are seen
+// (and scaled back up). Only applications that can't reach a builtin go
+// unmemoized: an impure entry is what keeps its effect from running again.
+// On bf-dsl that's 2.6M applications of 7.9M, for a seventh less memory;
+// what recomputing them costs is about what storing them did.
+struct memo_policy_t {
+
+    static const uint32_t window = 4096, sample = 16;
+
+    bool off = false;
+    uint32_t probes = 0, hits = 0, misses = 0, calls = 0;
+    // steps taken by this window's misses
+    uint64_t work = 0;
+
+    // whether the next application is memoized
+    bool memoize() {
+        return !off || ++calls % sample == 0;
+    }
+
+    void hit() {
+        ++hits;
+        if (++probes == window)
+            decide();
+    }
+
+    // a miss evaluated in steps applications, itself included
+    void miss(size_t steps) {
+        ++misses;
+        work += steps;
+        if (++probes == window)
+            decide();
+    }
+
+    void decide() {
+        double saved = double(hits) * (off ? sample : 1) * work / max<uint32_t>(misses, 1);
+        off = off ? saved * 4 < probes : saved * 8 < probes;
+        probes = hits = misses = 0;
+        work = 0;
+    }
+};
+
+// What's kept about an expr besides its node, see heap_t
+struct expr_t {
+
+    const expr_id_t id;
+    mutable env_cache_t lmb_cache;
+    // thunks of this expr, keyed on the env it's suspended in
+    mutable env_cache_t thunk_cache;
+    // as a body: results of calls taking several arguments at once, keyed
+    // on the callee and the arguments, see apply_n
+    mutable env_cache_t call_cache;
+    // same across runs for the same structure
+    uint64_t fp;
+    // whether memo_file_t has records for closures of this body, -1 unknown
+    mutable int memo_hint;
+    // whether a builtin is among its nodes
+    bool effects;
+    // \ directly nested from here on, so a closure of this body takes
+    // 1 + lams arguments before doing any work
+    uint32_t lams;
+    // as a body: thunks it was passed, and how many of them were forced
+    mutable uint32_t passed, forced;
+    // as a body: closures made of it, see print_heap_report
+    mutable size_t made;
+    // as a body: whether its closures memoize, see apply
+    mutable memo_policy_t memo;
+
+    expr_t(expr_id_t _id, uint64_t _fp, bool _effects, uint32_t _lams) :
+        id(_id), fp(_fp), memo_hint(-1), effects(_effects), lams(_lams), passed(0), forced(0), made(0) {}
+
+    // mostly forces its argument, so it may as well get the value
+    bool strict() const {
+        return passed > 0 && forced * 4 >= passed * 3;
+    }
+};
+
+// heap_t {{{
+
+// Exprs and closures of one engine, with what they keep track of. Eval
+// reaches it through current, set by the engine for as long as it runs.
+struct heap_t {
+
+    static thread_local heap_t *current;
+
+    static heap_t& cur() {
+        return *current;
+    }
+
+    // closures, see lmb_t
+    lmb_idx_t gidx = 0;
+    size_t live = 0;
+    const lmb_t *head = nullptr;
+    vector<uint32_t> epochs;
+    vector<uint32_t> free_slots;
+
+    // cleared by I/O, see memo_t
+    bool pure = true;
+    // arguments are passed as thunks, see thunk_t
+    bool lazy = false;
+    // call sites take all their arguments at once, see eval_call
+    bool uncurry = true;
+    size_t calls = 0, call_hits = 0;
+    // applications found in eval_cache, see metrics_t
+    size_t memo_hits = 0;
+    size_t thunks = 0, forced = 0;
+    // applications left out of memo tables, see memo_policy_t; bodies
+    // whose fingerprint is in memo_hints start off
+    size_t unmemoized = 0;
+    unordered_set<uint64_t> memo_hints;
+    // applications evaluated; limits are looked at when step_limit is
+    // reached, see checkpoint
+    size_t steps = 0;
+    size_t step_limit = SIZE_MAX;
+
+    // every expr: its node, what eval looks at, and its record, what's
+    // kept about it; both indexed by expr_id_t. Records never move, they
+    // are referred to by closures. Exprs are hash-consed on node_ids.
+    vector<node_t> nodes;
+    vector<uint32_t> arg_maps;
+    deque<expr_t> exprs;
+    hash_map_t<vector<uint32_t>, expr_id_t> node_ids;
+};
+thread_local heap_t *heap_t::current = nullptr;
+
+// }}}
+
+// exprs {{{
+
+using arg_map_t = vector<size_t>;
+
+// the expr of node, made if it's new
+static expr_id_t make_expr(expr_kind_t kind, uint32_t a, uint32_t b, const arg_map_t &arg_map) {
+
+    heap_t &heap = heap_t::cur();
+
+    vector<uint32_t> key{kind, a, b};
+    key.insert(key.end(), arg_map.begin(), arg_map.end());
+    // off by one, 0 is a new entry
+    auto &ref = heap.node_ids[key];
+    if (ref != 0)
+        return ref - 1;
+
+    node_t node;
+    node.kind = kind;
+    node.len = arg_map.size();
+    node.a = a;
+    node.b = b;
+
+    vector<uint64_t> words;
+    bool effects = true;
+    uint32_t lams = 0;
+    switch (kind) {
+        case LMB:
+            node.b = heap.arg_maps.size();
+            heap.arg_maps.insert(heap.arg_maps.end(), arg_map.begin(), arg_map.end());
+            words = {'l', heap.exprs[a].fp};
+            words.insert(words.end(), arg_map.begin(), arg_map.end());
+            effects = heap.exprs[a].effects;
+            lams = 1 + heap.exprs[a].lams;
+            break;
+        case APPLY:
+            node.len = heap.nodes[a].kind == APPLY ? min<uint32_t>(heap.nodes[a].len + 1, max_call_args + 1) : 1;
+            words = {'a', heap.exprs[a].fp, heap.exprs[b].fp};
+            effects = heap.exprs[a].effects || heap.exprs[b].effects;
+            break;
+        case REF:
+            words = {'r', a};
+            effects = false;
+            break;
+        case P0: words = {'b', '0'}; break;
+        case P1: words = {'b', '1'}; break;
+        case G: words = {'b', 'g'}; break;
+        case GETBYTE: words = {'b', 'r'}; break;
+        case PUTBYTE: words = {'b', 'w'}; break;
+    }
+
+    expr_id_t id = heap.nodes.size();
+    heap.nodes.push_back(node);
+    heap.exprs.emplace_back(id, _fingerprint(words), effects, lams);
+    heap.exprs.back().memo.off = heap.memo_hints.count(heap.exprs.back().fp) > 0;
+    ref = id + 1;
+    return id;
+}
+
+static expr_id_t lmb_expr(expr_id_t body, const arg_map_t &arg_map) {
+    return make_expr(LMB, body, 0, arg_map);
+}
+
+static expr_id_t apply_expr(expr_id_t func, expr_id_t arg) {
+    return make_expr(APPLY, func, arg, arg_map_t());
+}
+
+static expr_id_t ref_expr(size_t idx) {
+    return make_expr(REF, idx, 0, arg_map_t());
+}
+
+static expr_id_t builtin_expr(expr_kind_t kind) {
+    return make_expr(kind, 0, 0, arg_map_t());
+}
+
+// }}}
+
+// a memoized application; pure unless it did (or reused) any I/O
+struct memo_t {
+    lmb_hdr_t val;
+    bool pure;
+};
+
+// keyed on a dead closure, and not what some eval() on the stack refers to.
+// A table only looks for them if closures died since it last did: that
+// reads the epoch of every key, a cache miss each, on most inserts.
+struct memo_stale_t {
+    uint32_t deaths = 0;
+    bool any();
+    bool operator()(const pair<lmb_idx_t, memo_t> &ent) const;
+};
+
+// A suspended application: an lmb_t whose body is evaluated with arg
+// shadowing its env the first time the value is used, see force(). The
+// body of the first closure it's passed to is told when that happens.
+struct thunk_t {
+    lmb_hdr_t arg;
+    lmb_hdr_t val;
+    const expr_t *callee;
+};
+
+// Closure ids are a slot in the low 32 bits tagged with the slot's epoch
+// in the high ones. Slots are recycled when a closure dies and the epoch
+// bumped, so entries keyed on a dead closure simply stop matching.
+struct lmb_t {
+
+    // what's read of a closure passed around, as an argument or in an
+    // env, comes first, so it's one cache line
+    const expr_t *body;
+    const lmb_idx_t idx;
+    // nullptr but for thunks
+    const unique_ptr<thunk_t> thunk;
+    // references held by the C++ stack (or the host)
+    mutable size_t roots;
+    // whether a builtin is reachable from it, through its body or env;
+    // using one that isn't can't do I/O
+    const bool effects;
+
+    const env_t env;
+    // ids hash to themselves: fresh slots are sequential and land in
+    // distinct buckets, mixing them measured no shorter probes (see
+    // --hash-stats), only slower lookups
+    mutable hash_map_t<lmb_idx_t, memo_t, hash<lmb_idx_t>, memo_stale_t> eval_cache;
+    mutable uint64_t fp;
+
+    // every live closure, so the collector can sweep them
+    mutable const lmb_t *prev, *next;
+
+    template <typename EU>
+    lmb_t(const expr_t *_body, EU&& _env, thunk_t *_thunk = nullptr) :
+        body(_body), idx(alloc_idx()), thunk(_thunk), roots(0),
+        effects(reaches(*_body, _env, _thunk)), env(forward<EU>(_env)), fp(0), prev(nullptr) {
+        heap_t &heap = heap_t::cur();
+        next = heap.head;
+        if (next)
+            next->prev = this;
+        heap.head = this;
+        ++heap.live;
+        ++heap.gidx;
+        ++body->made;
+    }
+
+    ~lmb_t();
+
+    static bool reaches(const expr_t &body, const env_t &env, const thunk_t *thunk) {
+        if (body.effects || (thunk && thunk->arg && thunk->arg->effects))
+            return true;
+        for (auto &lmb : env)
+            if (lmb->effects)
+                return true;
+        return false;
+    }
+
+    // body + env fingerprints, computed on first use
+    uint64_t fingerprint() const {
+        if (!fp) {
+            vector<uint64_t> words{'c', body->fp};
+            for (auto &lmb : env)
+                words.push_back(lmb->fingerprint());
+            fp = _fingerprint(words);
+        }
+        return fp;
+    }
+
+    static uint32_t slot(lmb_idx_t idx) {
+        return uint32_t(idx);
+    }
+
+    static bool alive(lmb_idx_t idx) {
+        return heap_t::cur().epochs[slot(idx)] == idx >> 32;
+    }
+
+    static lmb_idx_t alloc_idx() {
+        auto &epochs = heap_t::cur().epochs;
+        auto &free_slots = heap_t::cur().free_slots;
+        uint32_t slot;
+        if (free_slots.empty()) {
+            slot = epochs.size();
+            epochs.push_back(0);
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        return lmb_idx_t(epochs[slot]) << 32 | slot;
+    }
+};
+
+bool memo_stale_t::any() {
+    heap_t &heap = heap_t::cur();
+    const uint32_t now = uint32_t(heap.gidx - heap.live);
+    if (now == deaths)
+        return false;
+    deaths = now;
+    return true;
+}
+
+bool memo_stale_t::operator()(const pair<lmb_idx_t, memo_t> &ent) const {
+    return !lmb_t::alive(ent.first) && !(ent.second.val && ent.second.val->roots);
+}
+
+template <typename... Args>
+lmb_hdr_t make_lmb(Args&&... args) {
+    return make_shared<const lmb_t>(forward<Args>(args)...);
+}
+
+static const lmb_hdr_t& eval(expr_id_t id, const shadow_env_t &env);
+
+// the value of lmb, evaluating the thunk the first time it's asked for;
+// thunks never have effects, see suspend
+inline const lmb_hdr_t& force(const lmb_hdr_t &lmb) {
+
+    thunk_t *thunk = lmb->thunk.get();
+    if (thunk == nullptr)
+        return lmb;
+
+    if (thunk->val == nullptr) {
+        thunk->val = eval(lmb->body->id, shadow_env_t{thunk->arg, lmb->env});
+        ++heap_t::cur().forced;
+        if (thunk->callee)
+            ++thunk->callee->forced;
+    }
+    return thunk->val;
+}
+
+// what an env holds for lmb: the value once there is one
+inline const lmb_hdr_t& settled(const lmb_hdr_t &lmb) {
+    return lmb && lmb->thunk && lmb->thunk->val ? lmb->thunk->val : lmb;
+}
+
+// }}}
+
+// gc {{{
+
+// Mark & sweep over closures, run at application boundaries. Memo tables
+// are weak: a pure eval_cache entry never keeps its value alive, it's just
+// recomputed if the value was collected. Impure entries and the closures
+// they are keyed on must keep their identity though, otherwise the effect
+// would run again, so those are treated as ephemerons (alive as long as
+// their keys are).
+//
+// eval() hands out references into memo entries, so an entry holding a
+// rooted value is never freed; if its closure dies it's parked in limbo
+// until the value isn't rooted anymore.
+struct gc_t {
+
+    using memo_ent_t = unique_ptr<pair<lmb_idx_t, memo_t>>;
+
+    bool enabled = false;
+    size_t threshold = 1 << 18;
+    vector<memo_ent_t> limbo;
+    // limbo[0, limbo_kept) was rooted at the last trim, values deep in the
+    // stack mostly, so it's only looked at again once it doubled
+    size_t limbo_kept = 0, limbo_full = 64;
+
+    // stats
+    size_t collections = 0;
+    size_t freed = 0;
+    double pause_total = 0;
+    double pause_max = 0;
+
+    // state of the collection under way
+    vector<bool> marked;
+    vector<bool> pinned;
+    vector<const lmb_t*> stack;
+    unordered_map<lmb_idx_t, vector<const lmb_t*>> wait_vals;
+    unordered_map<lmb_idx_t, vector<pair<const env_cache_t*, const env_cache_t::ent_t*>>> wait_envs;
+
+    void poll() {
+        if (heap_t::cur().live >= threshold && enabled)
+            collect();
+        if (limbo.size() >= limbo_kept + 64)
+            trim_limbo(limbo_kept >= limbo_full);
+    }
+
+    static bool rooted(const memo_t &memo) {
+        return memo.val && memo.val->roots;
+    }
+
+    void trim_limbo(bool full) {
+        vector<memo_ent_t> dropped;
+        size_t kept = full ? 0 : limbo_kept;
+        for (size_t idx = kept; idx < limbo.size(); idx++)
+            if (!rooted(limbo[idx]->second))
+                dropped.push_back(move(limbo[idx]));
+            else if (idx != kept++)
+                limbo[kept - 1] = move(limbo[idx]);
+        limbo.resize(kept);
+        limbo_kept = kept;
+        if (full)
+            limbo_full = max<size_t>(64, kept * 2);
+        dropped.clear();
+    }
+
+    bool is_marked(lmb_idx_t idx) const {
+        return lmb_t::alive(idx) && marked[lmb_t::slot(idx)];
+    }
+
+    void mark(const lmb_t *lmb) {
+        if (lmb != nullptr && !marked[lmb_t::slot(lmb->idx)]) {
+            marked[lmb_t::slot(lmb->idx)] = true;
+            stack.push_back(lmb);
+        }
+    }
+
+    void mark_env(const env_cache_t *cache, const env_cache_t::ent_t *ent) {
+        const lmb_idx_t *key = cache->key(*ent);
+        for (size_t i = 0; i < ent->len; i++)
+            if (!is_marked(key[i])) {
+                wait_envs[key[i]].push_back(make_pair(cache, ent));
+                return;
+            }
+        mark(ent->val.get());
+    }
+
+    void drain() {
+
+        while (!stack.empty()) {
+
+            const lmb_t *lmb = stack.back();
+            stack.pop_back();
+
+            for (auto &val : lmb->env)
+                mark(val.get());
+            if (lmb->thunk) {
+                mark(lmb->thunk->arg.get());
+                mark(lmb->thunk->val.get());
+            }
+
+            for (auto &ent : lmb->eval_cache.table) {
+                if (!ent.second || ent.second->second.pure || !ent.second->second.val)
+                    continue;
+                if (is_marked(ent.second->first))
+                    mark(ent.second->second.val.get());
+                else if (lmb_t::alive(ent.second->first))
+                    wait_vals[ent.second->first].push_back(ent.second->second.val.get());
+            }
+
+            if (wait_vals.empty() && wait_envs.empty())
+                continue;
+
+            auto vit = wait_vals.find(lmb->idx);
+            if (vit != wait_vals.end()) {
+                for (auto val : vit->second)
+                    mark(val);
+                wait_vals.erase(vit);
+            }
+
+            auto eit = wait_envs.find(lmb->idx);
+            if (eit != wait_envs.end()) {
+                auto ents = move(eit->second);
+                wait_envs.erase(eit);
+                for (auto ent : ents)
+                    mark_env(ent.first, ent.second);
+            }
+        }
+    }
+
+    void collect() {
+
+        heap_t &heap = heap_t::cur();
+        auto start = chrono::steady_clock::now();
+        size_t before = heap.live;
+
+        marked.assign(heap.epochs.size(), false);
+        pinned.assign(heap.epochs.size(), false);
+
+        // roots, and closures whose identity is observable through an
+        // impure entry
+        for (auto lmb = heap.head; lmb != nullptr; lmb = lmb->next) {
+            if (lmb->roots)
+                mark(lmb);
+            for (auto &ent : lmb->eval_cache.table)
+                if (ent.second && !ent.second->second.pure && lmb_t::alive(ent.second->first))
+                    pinned[lmb_t::slot(lmb->idx)] = pinned[lmb_t::slot(ent.second->first)] = true;
+        }
+
+        // mark
+        for (auto &expr : heap.exprs)
+            for (auto cache : {&expr.lmb_cache, &expr.thunk_cache})
+                for (auto &ent : cache->table)
+                    if (ent.second && pinned[lmb_t::slot(ent.second->val->idx)])
+                        mark_env(cache, ent.second.get());
+        drain();
+
+        // sweep, deferring every release until the heap list is walked
+        vector<env_cache_t::ent_hdr_t> dropped_lmbs;
+        vector<memo_ent_t> dropped_vals;
+        vector<memo_ent_t> nlimbo;
+
+        auto is_dead = [&](const pair<lmb_idx_t, memo_t> &ent) {
+            return (ent.second.val && !marked[lmb_t::slot(ent.second.val->idx)]) || memo_stale_t()(ent);
+        };
+
+        for (auto &expr : heap.exprs)
+            for (auto cache : {&expr.lmb_cache, &expr.thunk_cache})
+                cache->erase_if([&](const env_cache_t::ent_t &ent) {
+                    return !marked[lmb_t::slot(ent.val->idx)];
+                }, dropped_lmbs);
+
+        // calls are pure, so weak like pure entries, and the value doesn't
+        // keep the callee and arguments alive
+        for (auto &expr : heap.exprs)
+            expr.call_cache.erase_if([&](const env_cache_t::ent_t &ent) {
+                if (!marked[lmb_t::slot(ent.val->idx)])
+                    return true;
+                const lmb_idx_t *key = expr.call_cache.key(ent);
+                for (size_t i = 0; i < ent.len; i++)
+                    if (!is_marked(key[i]))
+                        return !ent.val->roots;
+                return false;
+            }, dropped_lmbs);
+
+        for (auto lmb = heap.head; lmb != nullptr; lmb = lmb->next) {
+            if (marked[lmb_t::slot(lmb->idx)]) {
+                lmb->eval_cache.erase_if(is_dead, dropped_vals);
+            } else {
+                for (auto &ent : lmb->eval_cache.table)
+                    if (ent.second)
+                        (rooted(ent.second->second) ? nlimbo : dropped_vals).push_back(move(ent.second));
+                lmb->eval_cache = decltype(lmb->eval_cache)();
+            }
+        }
+
+        for (auto &ent : limbo)
+            (rooted(ent->second) ? nlimbo : dropped_vals).push_back(move(ent));
+        limbo.swap(nlimbo);
+        limbo_kept = 0;
+
+        // keys never marked are left waiting
+        wait_vals.clear();
+        wait_envs.clear();
+
+        dropped_lmbs.clear();
+        dropped_vals.clear();
+        nlimbo.clear();
+
+        threshold = max(threshold, heap.live * 2);
+
+        double pause = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        ++collections;
+        freed += before - heap.live;
+        pause_total += pause;
+        pause_max = max(pause_max, pause);
+    }
+};
+
+// everything held by reference on the C++ stack must be a root
+struct gc_root_t {
+    const lmb_t *lmb;
+    gc_root_t(const lmb_t *_lmb) : lmb(_lmb) { if (lmb) ++lmb->roots; }
+    ~gc_root_t() { if (lmb) --lmb->roots; }
+};
+
+// the same for the arguments of a call, see eval_call
+struct gc_roots_t {
+    const lmb_t *lmbs[max_call_args];
+    size_t len = 0;
+    void push(const lmb_t *lmb) { ++lmb->roots; lmbs[len++] = lmb; }
+    ~gc_roots_t() { while (len > 0) --lmbs[--len]->roots; }
+};
+
+// }}}
+
+// memo_file_t {{{
+
+// Pure applications persisted across runs, keyed on fingerprints instead of
+// per-process closure ids. The file is an append-only run of 64 bit words:
+//
+//   magic
+//   'D' fp body_fp n env_fp*n      closure definition
+//   'A' body_fp func_fp arg_fp val_fp
+//                                  pure application of a closure of body
+//
+// It is mmap'ed and indexed at startup. New records are appended in one
+// block (O_APPEND) by sync(), between runs, which also indexes what other
+// processes appended meanwhile, so batch workers share results input by
+// input; and at exit. Writing, and opening, which may create the file or
+// drop a torn record an interrupted run left at its end, hold an flock(),
+// so readers only ever see the block being appended incomplete. Only
+// closures of a body with records in the file are looked up at all; what
+// this run stores is in eval_cache already.
+// Results are rebuilt through lmb_cache so they are the very closures the
+// program would have made itself.
+struct memo_file_t {
+
+    static const uint64_t magic = 0x314f4d454d424d4cULL;    // "LMBMEMO1"
+
+    bool enabled = false;
+    size_t min_steps = 256;
+
+    int fd = -1;
+    const uint64_t *mapped = nullptr;
+    size_t mapped_size = 0;
+    // the file is indexed up to there, a record may be half written past it
+    size_t indexed = 0;
+    // what this process wrote, the first flushed of it in the file already
+    vector<uint64_t> pending;
+    size_t flushed = 0;
+
+    // fp -> offset of the definition, in the file or, with own, in pending
+    static const size_t own = size_t(1) << 63;
+    unordered_map<uint64_t, size_t> defs;
+    unordered_map<pair<uint64_t, uint64_t>, uint64_t, hash<pair<uint64_t, uint64_t>>> applies;
+    unordered_set<uint64_t> bodies;
+    unordered_map<uint64_t, const expr_t*> exprs;
+    size_t exprs_indexed = 0;
+    // closures already rebuilt, envs are DAGs sharing a lot
+    unordered_map<uint64_t, weak_ptr<const lmb_t>> built;
+
+    // stats
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t written = 0;
+
+    // the file to this process, while in scope
+    struct lock_t {
+        int fd;
+        lock_t(int _fd) : fd(_fd) {
+            while (flock(fd, LOCK_EX) < 0 && errno == EINTR);
+        }
+        ~lock_t() {
+            flock(fd, LOCK_UN);
+        }
+    };
+
+    ~memo_file_t() {
+        if (mapped != nullptr)
+            munmap((void*)mapped, mapped_size);
+    }
+
+    // map the file as it is now, false if it isn't a memo file
+    bool map(size_t size) {
+        if (mapped != nullptr)
+            munmap((void*)mapped, mapped_size);
+        mapped = nullptr;
+        mapped_size = size;
+        void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED || ((const uint64_t*)addr)[0] != magic)
+            return false;
+        mapped = (const uint64_t*)addr;
+        return true;
+    }
+
+    // index records from indexed on, up to the first incomplete one; the
+    // definitions and results already known are kept. Returns whether
+    // records of bodies not seen before were found.
+    bool index() {
+        size_t words = mapped_size / sizeof(uint64_t);
+        size_t off = indexed;
+        bool new_bodies = false;
+        while (off < words) {
+            const uint64_t *rec = mapped + off;
+            size_t len = rec[0] == 'A' ? 5 : rec[0] == 'D' && off + 3 < words && rec[3] <= words - off - 4 ? 4 + rec[3] : 0;
+            if (len == 0 || off + len > words)
+                break;
+            if (rec[0] == 'A') {
+                new_bodies |= bodies.insert(rec[1]).second;
+                applies.emplace(make_pair(rec[2], rec[3]), rec[4]);
+            } else
+                defs.emplace(rec[1], off);
+            off += len;
+        }
+        indexed = off;
+        return new_bodies;
+    }
+
+    bool open(const char *path) {
+
+        fd = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            cerr << "memo file: can't open " << path << endl;
+            return false;
+        }
+        lock_t lock(fd);
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            cerr << "memo file: can't open " << path << endl;
+            return false;
+        }
+
+        indexed = 1;
+        if (st.st_size == 0)
+            return enabled = write(fd, &magic, sizeof(magic)) == sizeof(magic);
+
+        if (!map(st.st_size)) {
+            cerr << "memo file: " << path << " is not a memo file" << endl;
+            return false;
+        }
+
+        // dropping a torn record left by an interrupted run: with the lock,
+        // no one else is writing
+        index();
+        if (indexed * sizeof(uint64_t) != size_t(st.st_size) && ftruncate(fd, indexed * sizeof(uint64_t)) < 0)
+            return false;
+
+        return enabled = true;
+    }
+
+    // append what's pending, then index what others appended, this
+    // included. Bodies left out of lookups may have records now.
+    void sync() {
+        if (!enabled)
+            return;
+        flush();
+        struct stat st;
+        if (fstat(fd, &st) < 0 || size_t(st.st_size) <= mapped_size)
+            return;
+        if (!map(st.st_size)) {
+            enabled = false;
+            return;
+        }
+        if (index())
+            for (auto &expr : heap_t::cur().exprs)
+                if (expr.memo_hint == 0)
+                    expr.memo_hint = -1;
+    }
+
+    void flush() {
+        if (flushed == pending.size())
+            return;
+        lock_t lock(fd);
+        const char *buf = (const char*)(pending.data() + flushed);
+        size_t left = (pending.size() - flushed) * sizeof(uint64_t);
+        while (left > 0) {
+            ssize_t n = write(fd, buf, left);
+            if (n <= 0)
+                break;
+            buf += n, left -= n;
+        }
+        flushed = pending.size();
+    }
+
+    void close() {
+        if (!enabled)
+            return;
+        flush();
+        ::close(fd);
+        enabled = false;
+    }
+
+    const uint64_t* record(size_t off) {
+        return off & own ? pending.data() + (off & ~own) : mapped + off;
+    }
+
+    const expr_t* find_expr(uint64_t fp) {
+        auto it = exprs.find(fp);
+        if (it != exprs.end())
+            return it->second;
+        auto &all = heap_t::cur().exprs;
+        for (; exprs_indexed < all.size(); exprs_indexed++)
+            exprs.emplace(all[exprs_indexed].fp, &all[exprs_indexed]);
+        it = exprs.find(fp);
+        return it == exprs.end() ? nullptr : it->second;
+    }
+
+    // rebuild the closure with fingerprint fp, nullptr if it isn't known
+    // (or comes from some other program)
+    lmb_hdr_t materialize(uint64_t fp) {
+
+        if (auto lmb = built[fp].lock())
+            return lmb;
+
+        auto it = defs.find(fp);
+        if (it == defs.end())
+            return nullptr;
+        const uint64_t *rec = record(it->second);
+        const expr_t *body = find_expr(rec[2]);
+        if (body == nullptr)
+            return nullptr;
+
+        size_t n = rec[3];
+        env_t nenv;
+        nenv.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            auto lmb = materialize(rec[4 + i]);
+            if (lmb == nullptr)
+                return nullptr;
+            nenv.push_back(move(lmb));
+        }
+
+        env_key_t key(n);
+        for (auto &lmb : nenv)
+            key.push_back(lmb->idx);
+
+        auto &ref = body->lmb_cache[key];
+        if (ref == nullptr)
+            ref = make_lmb(body, move(nenv));
+        ref->fp = fp;
+        built[fp] = ref;
+        return ref;
+    }
+
+    bool lookup(const lmb_t &func, const lmb_t &arg, lmb_hdr_t &val) {
+        const expr_t &body = *func.body;
+        if (body.memo_hint < 0)
+            body.memo_hint = bodies.count(body.fp);
+        if (!body.memo_hint)
+            return false;
+        auto it = applies.find(make_pair(func.fingerprint(), arg.fingerprint()));
+        if (it != applies.end() && (val = materialize(it->second)) != nullptr) {
+            ++hits;
+            return true;
+        }
+        ++misses;
+        return false;
+    }
+
+    void define(const lmb_t &lmb) {
+        uint64_t fp = lmb.fingerprint();
+        if (defs.count(fp))
+            return;
+        for (auto &sub : lmb.env)
+            define(*sub);
+        defs[fp] = own | pending.size();
+        pending.insert(pending.end(), {'D', fp, lmb.body->fp, lmb.env.size()});
+        for (auto &sub : lmb.env)
+            pending.push_back(sub->fp);
+        ++written;
+    }
+
+    // only applications that took at least min_steps are worth a record
+    void store(const lmb_t &func, const lmb_t &arg, const lmb_t &val, size_t start) {
+        if (heap_t::cur().steps - start < min_steps)
+            return;
+        auto key = make_pair(func.fingerprint(), arg.fingerprint());
+        if (applies.count(key))
+            return;
+        define(val);
+        applies[key] = val.fp;
+        pending.insert(pending.end(), {'A', func.body->fp, key.first, key.second, val.fp});
+        ++written;
+    }
+};
+const uint64_t memo_file_t::magic;
+const size_t memo_file_t::own;
+
+// }}}
+
+// engine_t::state_t {{{
+
+// byte streams behind the builtins, and where they are within a byte
+struct io_t {
+
+    engine_t::getc_t getc;
+    engine_t::putc_t putc;
+    int in_pos = -1, in_val = 0;
+    int out_pos = 7, out_val = 0;
+    bool in_used = false;
+    // bytes read and written by every run so far
+    size_t bytes_in = 0, bytes_out = 0;
+
+    // output of the expressions a snapshot skips, put out again by every
+    // run, and where more is collected while a snapshot is pending
+    string prelude;
+    int prelude_pos = 7, prelude_val = 0;
+    string *tee = nullptr;
+
+    void reset() {
+        in_pos = -1, in_val = 0;
+        out_pos = 7, out_val = 0;
+        in_used = false;
+    }
+};
+
+// a top level expression with its free names bound
+struct prog_t {
+    expr_id_t expr;
+    lmb_hdr_t arg;
+    env_t env;
+};
+
+// What a run may use, see engine_t::limits. Steps and the stack are
+// checked on every application evaluated, steps through
+// heap_t::step_limit; the rest when that's reached, every check_every
+// applications at most, see checkpoint().
+struct limits_t {
+
+    static const size_t check_every = 1024;
+    // kept past stack_end for what runs between two applications, from
+    // builtins to heap reports, and for unwinding; a quarter of the stack
+    // at most
+    static const size_t stack_margin = 256 << 10;
+
+    size_t max_steps = 0;
+    size_t max_heap_kb = 0;
+    double timeout = 0;
+    double idle = 0;
+
+    // of the run under way; stack_end is as far as the stack may grow
+    size_t steps_end = SIZE_MAX;
+    chrono::steady_clock::time_point deadline;
+    const char *stack_end = nullptr;
+    size_t checks = 0;
+    int statm = -1;
+
+    ~limits_t() {
+        if (statm >= 0)
+            close(statm);
+    }
+
+    // resident size of the process
+    size_t resident_kb() {
+        char buf[128];
+        if (statm < 0)
+            statm = ::open("/proc/self/statm", O_RDONLY);
+        ssize_t got = statm < 0 ? -1 : pread(statm, buf, sizeof(buf) - 1, 0);
+        if (got <= 0)
+            return 0;
+        buf[got] = 0;
+        size_t pages = 0, resident = 0;
+        sscanf(buf, "%zu %zu", &pages, &resident);
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+};
+const size_t limits_t::stack_margin;
+
+// thrown through eval once a limit of the run is reached
+struct limit_t {
+    engine_t::status_t status;
+};
+
+// The stack of a run made with engine_t::start, and where it's switched
+// from and to. The stack is only reserved, pages are taken as it grows,
+// and kept for the next run.
+struct fiber_t {
+
+    static const size_t stack_size = size_t(1) << 30;
+
+    char *stack = nullptr;
+    ucontext_t caller, self;
+    // a run is on it, suspended or not
+    bool running = false;
+
+    ~fiber_t() {
+        if (stack != nullptr)
+            munmap(stack, stack_size);
+    }
+};
+
+// Where engine_t::metrics lines go, stderr for those asked for without it,
+// and what the last one saw, for the rates. Lines are written while
+// running only: periodic ones at checkpoint()s, which begin_run arms for
+// them only with an interval, and asked for ones at the next application.
+struct metrics_t {
+
+    ostream *os = nullptr;
+    double interval = 0;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now(), last = start, next;
+    size_t steps = 0, gidx = 0, hits = 0;
+};
+
+struct engine_t::state_t : public heap_t {
+
+    gc_t gc;
+    memo_file_t memo_file;
+    io_t io;
+
+    map<string, lmb_hdr_t> builtins;
+    // Church booleans, and the \b7 .. \b0 \f f b7 .. b0 a byte is built
+    // with, see eval_builtin
+    lmb_hdr_t bits[2];
+    lmb_hdr_t byte_mk;
+    const expr_t *byte_body;
+    vector<prog_t> progs;
+    size_t next_prog = 0;
+    limits_t limits;
+    metrics_t metrics;
+    fiber_t fiber;
+    // why the last run was abandoned, DONE if it wasn't
+    engine_t::status_t aborted = engine_t::DONE;
+
+    // see snapshot_t
+    string snapshot_path;
+    size_t snapshot_after = SIZE_MAX;
+    string snapshot_out;
+
+    // where each lambda body was first parsed, and where to report the
+    // heap when asked to, see print_heap_report
+    unordered_map<const expr_t*, string> sources;
+    ostream *heap_report_os = nullptr;
+    size_t heap_report_top = 0;
+
+    static state_t& cur() {
+        return static_cast<state_t&>(heap_t::cur());
+    }
+
+    ~state_t();
+};
+using state_t = engine_t::state_t;
+
+lmb_t::~lmb_t() {
+
+    state_t &st = state_t::cur();
+
+    for (auto &ent : eval_cache.table)
+        if (ent.second && gc_t::rooted(ent.second->second))
+            st.gc.limbo.push_back(move(ent.second));
+
+    if (prev)
+        prev->next = next;
+    else
+        st.head = next;
+    if (next)
+        next->prev = prev;
+    --st.live;
+
+    ++st.epochs[slot(idx)];
+    st.free_slots.push_back(slot(idx));
+}
+
+
+// }}}
+
+// heap report {{{
+
+// set from a signal handler, see engine_t::request_heap_report
+static volatile sig_atomic_t heap_report_requested = 0;
+
+// Bytes held on behalf of each lambda body: its closures with their envs
+// and eval_cache tables, its call_cache (counted with the memo tables) and
+// its lmb_cache. Payloads and table slots are counted, allocator overhead
+// isn't.
+static void heap_report(const state_t &st, ostream &os, size_t top) {
+
+    struct usage_t {
+        const expr_t *body = nullptr;
+        size_t live = 0;
+        size_t closures = 0, envs = 0;
+        size_t memos = 0, memo_bytes = 0;
+        size_t lmbs = 0, lmb_bytes = 0;
+        size_t total() const { return closures + envs + memo_bytes + lmb_bytes; }
+    };
+    unordered_map<const expr_t*, usage_t> uses;
+
+    // make_shared puts the counts next to the closure
+    const size_t lmb_size = sizeof(lmb_t) + 2 * sizeof(long);
+    const size_t memo_slot = sizeof(decltype(lmb_t::eval_cache.table)::value_type);
+    const size_t memo_ent = sizeof(pair<lmb_idx_t, memo_t>);
+    const size_t env_slot = sizeof(decltype(env_cache_t::table)::value_type);
+
+    for (auto lmb = st.head; lmb != nullptr; lmb = lmb->next) {
+        auto &use = uses[lmb->body];
+        use.live++;
+        use.closures += lmb_size + (lmb->thunk ? sizeof(thunk_t) : 0);
+        use.envs += lmb->env.capacity() * sizeof(lmb_hdr_t);
+        use.memos += lmb->eval_cache.size;
+        use.memo_bytes += lmb->eval_cache.table.capacity() * memo_slot + lmb->eval_cache.size * memo_ent;
+    }
+    for (auto &expr : st.exprs) {
+        if (expr.call_cache.size > 0) {
+            auto &use = uses[&expr];
+            use.memos += expr.call_cache.size;
+            use.memo_bytes += expr.call_cache.table.capacity() * env_slot + expr.call_cache.size * sizeof(env_cache_t::ent_t)
+                + expr.call_cache.arena.capacity() * sizeof(lmb_idx_t);
+        }
+        for (auto cache : {&expr.lmb_cache, &expr.thunk_cache}) {
+            if (cache->size == 0)
+                continue;
+            auto &use = uses[&expr];
+            use.lmbs += cache->size;
+            use.lmb_bytes += cache->table.capacity() * env_slot + cache->size * sizeof(env_cache_t::ent_t)
+                + cache->arena.capacity() * sizeof(lmb_idx_t);
+        }
+    }
+
+    vector<usage_t> sorted;
+    usage_t all;
+    for (auto &pair : uses) {
+        pair.second.body = pair.first;
+        sorted.push_back(pair.second);
+        all.live += pair.second.live;
+        all.closures += pair.second.closures;
+        all.envs += pair.second.envs;
+        all.memos += pair.second.memos;
+        all.memo_bytes += pair.second.memo_bytes;
+        all.lmbs += pair.second.lmbs;
+        all.lmb_bytes += pair.second.lmb_bytes;
+    }
+    sort(sorted.begin(), sorted.end(), [](const usage_t &a, const usage_t &b) { return a.total() > b.total(); });
+    if (sorted.size() > top)
+        sorted.resize(top);
+
+    auto bytes = [](size_t n) {
+        ostringstream buf;
+        const char *units = "BKMGT";
+        double val = n;
+        while (val >= 1024 && units[1])
+            val /= 1024, units++;
+        buf << fixed << setprecision(*units == 'B' ? 0 : 1) << val << *units;
+        return buf.str();
+    };
+
+    auto row = [&](const usage_t &use, size_t made, const string &where) {
+        os << setw(9) << bytes(use.total()) << setw(10) << made << setw(10) << use.live
+           << setw(9) << bytes(use.closures) << setw(9) << bytes(use.envs)
+           << setw(10) << use.memos << setw(9) << bytes(use.memo_bytes)
+           << setw(10) << use.lmbs << setw(9) << bytes(use.lmb_bytes) << "  " << where << endl;
+    };
+
+    os << "heap report: " << st.live << " closures live, " << st.nodes.size() << " exprs" << endl;
+    os << setw(9) << "total" << setw(10) << "made" << setw(10) << "live"
+       << setw(9) << "closure" << setw(9) << "env"
+       << setw(10) << "memos" << setw(9) << "memo"
+       << setw(10) << "lmbs" << setw(9) << "lmb" << "  " << "body" << endl;
+    for (auto &use : sorted) {
+        auto it = st.sources.find(use.body);
+        row(use, use.body->made, it != st.sources.end() ? it->second : "(no source)");
+    }
+    row(all, st.gidx, "(all)");
+}
+
+// }}}
+
+// metrics {{{
+
+// set from a signal handler, see engine_t::request_metrics
+static volatile sig_atomic_t metrics_requested = 0;
+
+// One JSON line of counters, totals since the engine was made and rates
+// since the line before. Memo tables are sized by walking the closures and
+// exprs, as heap_report does, so a line costs about as much as a gc.
+static void write_metrics(state_t &st) {
+
+    metrics_t &met = st.metrics;
+    auto now = chrono::steady_clock::now();
+    double secs = chrono::duration<double>(now - met.last).count();
+    auto rate = [&](size_t cur, size_t prev) { return secs > 0 ? (cur - prev) / secs : 0; };
+
+    size_t memos = 0, calls = 0, lmbs = 0;
+    for (auto lmb = st.head; lmb != nullptr; lmb = lmb->next)
+        memos += lmb->eval_cache.size;
+    for (auto &expr : st.exprs) {
+        calls += expr.call_cache.size;
+        lmbs += expr.lmb_cache.size + expr.thunk_cache.size;
+    }
+
+    // every application evaluated missed eval_cache or call_cache
+    size_t hits = st.memo_hits + st.call_hits;
+    size_t probes = hits - met.hits + st.steps - met.steps;
+
+    ostringstream os;
+    os << "{\"t\":" << fixed << setprecision(3) << chrono::duration<double>(now - met.start).count()
+       << ",\"pid\":" << getpid()
+       << ",\"applications\":" << st.steps
+       << ",\"applications_per_sec\":" << setprecision(0) << rate(st.steps, met.steps)
+       << ",\"closures_allocated\":" << st.gidx
+       << ",\"closures_per_sec\":" << rate(st.gidx, met.gidx)
+       << ",\"closures_live\":" << st.live
+       << ",\"memo_entries\":" << memos
+       << ",\"call_entries\":" << calls
+       << ",\"lmb_entries\":" << lmbs
+       << ",\"memo_hits\":" << hits
+       << ",\"memo_hit_rate\":" << setprecision(4) << (probes ? double(hits - met.hits) / probes : 0)
+       << ",\"unmemoized\":" << st.unmemoized
+       << ",\"bytes_in\":" << st.io.bytes_in
+       << ",\"bytes_out\":" << st.io.bytes_out
+       << ",\"gc_collections\":" << st.gc.collections
+       << ",\"resident_kb\":" << st.limits.resident_kb()
+       << "}\n";
+    *(met.os != nullptr ? met.os : &cerr) << os.str() << flush;
+
+    met.last = now;
+    met.steps = st.steps;
+    met.gidx = st.gidx;
+    met.hits = hits;
+}
+
+// }}}
+
+// eval {{{
+
+static const lmb_hdr_t& apply(const lmb_hdr_t &lfunc, const lmb_hdr_t &_larg);
+// kept out of eval, whose frame is on the stack at every level of the
+// program's recursion: inlined, their arrays of args near triple it
+__attribute__((noinline)) static const lmb_hdr_t& eval_call(expr_id_t id, const shadow_env_t &env);
+__attribute__((noinline)) static const lmb_hdr_t& eval_builtin(const node_t &node, const shadow_env_t &env);
+
+// Put off only applications, the rest does no work, and only when nothing
+// in reach has effects: the I/O order of a program is the one of
+// call-by-value, and it's free to sequence it through arguments it then
+// drops. What's left is pure, so a thunk is shared by every suspension in
+// the same env, as closures are.
+static const lmb_hdr_t& suspend(expr_id_t id, const shadow_env_t &env) {
+
+    heap_t &heap = heap_t::cur();
+    const node_t &node = heap.nodes[id];
+    if (node.kind == REF)
+        return settled(env[node.a]);
+
+    const expr_t &expr = heap.exprs[id];
+    if (node.kind != APPLY || expr.effects || (env.shadow_val && env.shadow_val->effects))
+        return eval(id, env);
+
+    env_key_t key(env.orgi_env.size() + 1);
+    key.push_back(env.shadow_val ? env.shadow_val->idx : ~lmb_idx_t(0));
+    for (auto &lmb : env.orgi_env) {
+        if (lmb->effects)
+            return eval(id, env);
+        key.push_back(lmb->idx);
+    }
+
+    auto &ref = expr.thunk_cache[key];
+    if (ref == nullptr) {
+        ref = make_lmb(&expr, env.orgi_env, new thunk_t{env.shadow_val, nullptr, nullptr});
+        ++heap.thunks;
+    }
+
+    return settled(ref);
+}
+
+static const lmb_hdr_t& eval(expr_id_t id, const shadow_env_t &env) {
+
+    heap_t &heap = heap_t::cur();
+    const node_t &node = heap.nodes[id];
+
+    switch (node.kind) {
+
+        case LMB: {
+            const uint32_t *arg_map = heap.arg_maps.data() + node.b;
+            env_key_t key(node.len);
+            for (size_t i = 0; i < node.len; i++)
+                key.push_back(env[arg_map[i]]->idx);
+
+            const expr_t &body = heap.exprs[node.a];
+            auto &ref = body.lmb_cache[key];
+            if (ref == nullptr) {
+
+                env_t nenv;
+                nenv.reserve(node.len);
+                for (size_t i = 0; i < node.len; i++)
+                    nenv.emplace_back(env[arg_map[i]]);
+
+                ref = make_lmb(&body, move(nenv));
+            }
+
+            return ref;
+        }
+
+        case APPLY: {
+            if (node.len > 1 && node.len <= max_call_args && heap.uncurry && !heap.lazy)
+                return eval_call(id, env);
+            auto& lfunc = eval(node.a, env);
+            gc_root_t froot(lfunc.get());
+            // a callee that needs its argument anyway gets it evaluated, so
+            // the application is memoized on the value
+            if (heap.lazy && !lfunc->body->strict())
+                return apply(lfunc, suspend(node.b, env));
+            return apply(lfunc, eval(node.b, env));
+        }
+
+        case REF:
+            return force(env[node.a]);
+
+        default:
+            return eval_builtin(node, env);
+    }
+}
+
+// whether the stack has grown down to limits_t::stack_end
+static inline bool out_of_stack(const state_t &st) {
+    return uintptr_t(__builtin_frame_address(0)) < uintptr_t(st.limits.stack_end);
+}
+
+// Called once start, the step about to be taken, reaches step_limit, or
+// the stack its end: throws if the run is out of steps, stack, time or
+// memory, writes metrics when due, and moves step_limit on to the next
+// check. Resident memory costs a read of /proc, so it's looked at one
+// check in 8.
+static void checkpoint(state_t &st, size_t start) {
+
+    limits_t &lim = st.limits;
+    if (start >= lim.steps_end)
+        throw limit_t{engine_t::BUDGET};
+    if (out_of_stack(st))
+        throw limit_t{engine_t::STACK};
+    if (lim.timeout > 0 && chrono::steady_clock::now() >= lim.deadline)
+        throw limit_t{engine_t::TIMEOUT};
+    if (lim.max_heap_kb && ++lim.checks % 8 == 0 && lim.resident_kb() > lim.max_heap_kb)
+        throw limit_t{engine_t::MEMORY};
+
+    metrics_t &met = st.metrics;
+    if (met.interval > 0 && chrono::steady_clock::now() >= met.next) {
+        write_metrics(st);
+        met.next = met.last + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(met.interval));
+    }
+
+    st.step_limit = min(lim.steps_end, start + limits_t::check_every);
+}
+
+// what's done between applications
+static inline void at_application(state_t &st) {
+    st.gc.poll();
+    if (heap_report_requested && st.heap_report_os != nullptr) {
+        heap_report_requested = 0;
+        heap_report(st, *st.heap_report_os, st.heap_report_top);
+    }
+    if (metrics_requested) {
+        metrics_requested = 0;
+        write_metrics(st);
+    }
+}
+
+// apply when the body's memo_policy_t says it doesn't pay: hits are still
+// taken, but the result isn't stored. It's parked in limbo instead, so the
+// reference handed out stays good while the value is rooted.
+static const lmb_hdr_t& apply_unmemoized(state_t &st, const lmb_hdr_t &lfunc, const lmb_hdr_t &larg) {
+
+    memo_policy_t &policy = lfunc->body->memo;
+    if (const memo_t *memo = lfunc->eval_cache.find(larg->idx))
+        if (memo->val) {
+            ++st.memo_hits;
+            policy.hit();
+            return memo->val;
+        }
+
+    if (larg->thunk && larg->thunk->callee == nullptr) {
+        larg->thunk->callee = lfunc->body;
+        ++lfunc->body->passed;
+    }
+    gc_t::memo_ent_t ent(new pair<lmb_idx_t, memo_t>(larg->idx, memo_t{nullptr, true}));
+    lmb_hdr_t &val = ent->second.val;
+    if (!st.memo_file.enabled || !st.memo_file.lookup(*lfunc, *larg, val)) {
+        size_t start = st.steps++;
+        if (start >= st.step_limit || out_of_stack(st))
+            checkpoint(st, start);
+        val = eval(lfunc->body->id, shadow_env_t{larg, lfunc->env});
+        policy.miss(st.steps - start);
+        if (st.memo_file.enabled)
+            st.memo_file.store(*lfunc, *larg, *val, start);
+    }
+
+    ++st.unmemoized;
+    st.gc.limbo.push_back(move(ent));
+    return val;
+}
+
+// lfunc must be rooted by the caller; larg may be a thunk, the application
+// is memoized on it until it's forced, on its value after
+static const lmb_hdr_t& apply(const lmb_hdr_t &lfunc, const lmb_hdr_t &_larg) {
+    state_t &st = state_t::cur();
+    const lmb_hdr_t &larg = settled(_larg);
+    gc_root_t aroot(larg.get());
+    at_application(st);
+
+    memo_policy_t &policy = lfunc->body->memo;
+    if (!lfunc->effects && !larg->effects && !policy.memoize())
+        return apply_unmemoized(st, lfunc, larg);
+
+    auto& ref = lfunc->eval_cache[larg->idx];
+    if (ref.val == nullptr) {
+        if (larg->thunk && larg->thunk->callee == nullptr) {
+            larg->thunk->callee = lfunc->body;
+            ++lfunc->body->passed;
+        }
+        if (st.memo_file.enabled && st.memo_file.lookup(*lfunc, *larg, ref.val)) {
+            ref.pure = true;
+            return ref.val;
+        }
+        size_t start = st.steps++;
+        if (start >= st.step_limit || out_of_stack(st))
+            checkpoint(st, start);
+        bool outer = st.pure;
+        st.pure = true;
+        ref.val = eval(lfunc->body->id, shadow_env_t{larg, lfunc->env});
+        policy.miss(st.steps - start);
+        ref.pure = st.pure;
+        st.pure = outer && ref.pure;
+        if (st.memo_file.enabled && ref.pure)
+            st.memo_file.store(*lfunc, *larg, *ref.val, start);
+        if (larg->thunk && larg->thunk->val) {
+            auto& vref = lfunc->eval_cache[larg->thunk->val->idx];
+            if (vref.val == nullptr)
+                vref = ref;
+        }
+    } else {
+        ++st.memo_hits;
+        policy.hit();
+        if (!ref.pure)
+            st.pure = false;
+    }
+    return ref.val;
+}
+
+// lfunc applied to n args when its body is n - 1 nested \ (see
+// expr_t::lams), memoized in one call_cache entry. The body of the
+// innermost \ is evaluated in the env the partial applications would have
+// built, without building them; if one was built before, by a call site
+// passing fewer args, it goes on from there so its memo tables are shared.
+// Only for what can't reach a builtin, so the result is pure. lfunc and
+// args must be rooted by the caller. Not inlined, see eval_call.
+__attribute__((noinline)) static const lmb_hdr_t& apply_n(const lmb_hdr_t &lfunc, const lmb_hdr_t *const *args, size_t n) {
+
+    state_t &st = state_t::cur();
+    at_application(st);
+
+    env_key_t key(n + 1);
+    key.push_back(lfunc->idx);
+    for (size_t i = 0; i < n; i++)
+        key.push_back((*args[i])->idx);
+
+    ++st.calls;
+    const expr_t &body = *lfunc->body;
+    if (auto val = body.call_cache.find(key)) {
+        ++st.call_hits;
+        body.memo.hit();
+        return *val;
+    }
+
+    env_t envs[max_call_args];
+    const env_t *cur_env = &lfunc->env;
+    expr_id_t inner = body.id;
+    for (size_t i = 0; i + 1 < n; i++) {
+
+        const node_t &node = st.nodes[inner];
+        const uint32_t *arg_map = st.arg_maps.data() + node.b;
+        shadow_env_t env{*args[i], *cur_env};
+        inner = node.a;
+
+        env_key_t pkey(node.len);
+        for (size_t j = 0; j < node.len; j++)
+            pkey.push_back(env[arg_map[j]]->idx);
+        if (const lmb_hdr_t *val = st.exprs[inner].lmb_cache.find(pkey)) {
+            for (size_t j = i + 1; j < n; j++) {
+                gc_root_t root(val->get());
+                val = &apply(*val, *args[j]);
+            }
+            return *val;
+        }
+
+        envs[i].reserve(node.len);
+        for (size_t j = 0; j < node.len; j++)
+            envs[i].emplace_back(env[arg_map[j]]);
+        cur_env = &envs[i];
+    }
+
+    size_t start = st.steps++;
+    if (start >= st.step_limit || out_of_stack(st))
+        checkpoint(st, start);
+    const lmb_hdr_t &val = eval(inner, shadow_env_t{*args[n - 1], *cur_env});
+    body.memo.miss(st.steps - start);
+    // val may be in envs, see apply_unmemoized
+    if (!body.memo.memoize()) {
+        ++st.unmemoized;
+        st.gc.limbo.emplace_back(new pair<lmb_idx_t, memo_t>(lfunc->idx, memo_t{val, true}));
+        return st.gc.limbo.back()->second.val;
+    }
+    return body.call_cache[key] = val;
+}
+
+// ((h a1) a2) .. an: h's value takes as many args at once as it can, see
+// apply_n, and the others one by one. Args are evaluated in the same
+// order either way, and the partial applications skipped do no I/O.
+static const lmb_hdr_t& eval_call(expr_id_t id, const shadow_env_t &env) {
+
+    heap_t &heap = heap_t::cur();
+    const size_t n = heap.nodes[id].len;
+    expr_id_t args[max_call_args];
+    for (size_t i = n; i-- > 0; id = heap.nodes[id].a)
+        args[i] = heap.nodes[id].b;
+
+    auto& lfunc = eval(id, env);
+    gc_root_t froot(lfunc.get());
+    const size_t k = min(n, size_t(1) + lfunc->body->lams);
+
+    gc_roots_t roots;
+    const lmb_hdr_t *vals[max_call_args];
+    const lmb_hdr_t *val = &lfunc;
+    bool effects = lfunc->effects;
+    if (k > 1) {
+        for (size_t i = 0; i < k; i++) {
+            vals[i] = &eval(args[i], env);
+            roots.push(vals[i]->get());
+            effects = effects || (*vals[i])->effects;
+        }
+        if (!effects) {
+            val = &apply_n(lfunc, vals, k);
+        } else {
+            for (size_t i = 0; i < k; i++) {
+                gc_root_t root(val->get());
+                val = &apply(*val, *vals[i]);
+            }
+        }
+    }
+
+    for (size_t i = k > 1 ? k : 0; i < n; i++) {
+        gc_root_t root(val->get());
+        val = &apply(*val, eval(args[i], env));
+    }
+    return *val;
+}
+
+// }}}
+
+// tokenizer {{{
+
+struct tokenizer_t {
+
+    istream &stm;
+    string spe_chars;
+    deque<string> toks;
+    // of the last line read
+    size_t line = 0;
+
+    tokenizer_t(istream &_stm) : stm(_stm), spe_chars("()\\") {}
+
+    string peak() {
+        while (toks.empty())
+            if (!_read_more())
+                return "";
+        return toks.front();
+    }
+
+    string pop() {
+        string retv = peak();
+        toks.pop_front();
+        return retv;
+    }
+
+    bool _read_more() {
+
+        string line;
+        do {
+            if (!getline(stm, line))
+                return false;
+            this->line++;
+        } while (line.length() == 0 || _is_comment(line));
+
+        _parse(line);
+        return true;
+    }
+
+    bool _is_comment(std::string &str) {
+        for (auto chr : str)
+            if (!isspace(chr))
+                return chr == '#';
+        return false;
+    }
+
+    void _parse(string &line) {
+
+        stringstream buf(line);
+
+        while (true) {
+
+            char c;
+            do {
+                if (!buf.get(c))
+                    return;
+            } while (isspace(c));
+
+            if (spe_chars.find(c) != string::npos) {
+                toks.push_back(string(1, c));
+                continue;
+            }
+
+            // identity
+            string tok;
+            do {
+                tok += c;
+                if (!buf.get(c)) {
+                    toks.push_back(tok);
+                    return;
+                }
+            } while (!isspace(c) && spe_chars.find(c) == string::npos);
+
+            toks.push_back(tok);
+            buf.unget();
+        }
+    }
+
+};
+
+// }}}
+
+// parser {{{
+
+struct parser_t {
+
+    parser_t() {}
+
+    expr_id_t parse_single_expr(tokenizer_t &tok, map<string, size_t> &ref) {
+
+        string token = tok.pop();
+        assert(token != "");
+
+        if (token == "(") {
+            auto retv = parse_expr(tok, ref);
+            assert(tok.peak() == ")");
+            tok.pop();
+            return retv;
+        }
+        if (token != "\\") {
+            if (!ref.count(token))
+                ref.insert(make_pair(token, ref.size()));
+            return ref_expr(ref[token]);
+        }
+
+        // lambda
+
+        map<string, size_t> nref;
+        size_t line = tok.line;
+        string arg = tok.pop();
+        assert(arg != "(" && arg != ")" && arg != "\\");
+        nref[arg] = 0;
+        auto body = parse_expr(tok, nref);
+        state_t::cur().sources.emplace(&state_t::cur().exprs[body], "\\" + arg + " line " + to_string(line));
+
+        nref.erase(arg);
+        vector<size_t> arg_map(nref.size());
+        for (auto pair : nref) {
+            if (!ref.count(pair.first))
+                ref.insert(make_pair(pair.first, ref.size()));
+            arg_map[pair.second-1] = ref[pair.first];
+        }
+
+        return lmb_expr(body, arg_map);
+    }
+
+    expr_id_t parse_expr(tokenizer_t &tok, map<string, size_t> &ref) {
+
+        auto func = parse_single_expr(tok, ref);
+        while (tok.peak() != ")" && tok.peak() != "") {
+            auto arg = parse_single_expr(tok, ref);
+            func = apply_expr(func, arg);
+        }
+
+        return func;
+    }
+
+    bool parse_once(tokenizer_t &tok, map<string, lmb_hdr_t> &env, prog_t &prog) {
+
+        if (tok.peak() == "")
+            return false;
+
+        map<string, size_t> ref;
+        prog.expr = parse_single_expr(tok, ref);
+
+        prog.arg = nullptr;
+        prog.env = env_t(ref.empty() ? 0 : ref.size() - 1);
+        for (auto pair : ref) {
+            if (!env.count(pair.first)) {
+                std::cerr << "Unknown ident: " << pair.first << std::endl;
+                return false;
+            } else if (pair.second > 0) {
+                prog.env[pair.second-1] = env[pair.first];
+            } else {
+                prog.arg = env[pair.first];
+            }
+        }
+
+        return true;
+    }
+};
+
+// }}}
+
+// runtime {{{
+
+void output(int bit) {
+
+    state_t &st = state_t::cur();
+    int &pos = st.io.out_pos;
+    int &val = st.io.out_val;
+
+    val |= (bit << pos--);
+    if (pos < 0) {
+        st.io.putc(val);
+        ++st.io.bytes_out;
+        if (st.io.tee != nullptr)
+            *st.io.tee += char(val);
+        pos = 7, val = 0;
+    }
+
+    st.pure = false;
+}
+
+int input() {
+
+    state_t &st = state_t::cur();
+    int &pos = st.io.in_pos;
+    int &val = st.io.in_val;
+
+    // even EOF depends on the input, which a pure result must not
+    st.pure = false;
+    st.io.in_used = true;
+
+    if (pos < 0) {
+        // no byte yet: the run waits for one on its fiber, if it has one.
+        // The wait doesn't count against the timeout, but one longer than
+        // idle stops the run.
+        limits_t &lim = st.limits;
+        while ((val = st.io.getc()) == engine_t::AGAIN && st.fiber.running) {
+            auto suspended = chrono::steady_clock::now();
+            swapcontext(&st.fiber.self, &st.fiber.caller);
+            auto waited = chrono::steady_clock::now() - suspended;
+            lim.deadline += waited;
+            if (lim.idle > 0 && waited >= chrono::duration<double>(lim.idle))
+                throw limit_t{engine_t::TIMEOUT};
+        }
+        if (val == EOF || val == engine_t::AGAIN)
+            return EOF;
+        ++st.io.bytes_in;
+        pos = 7;
+    }
+
+    return (val >> pos--) & 1;
+}
+
+
+// A byte is \f f b7 .. b0 over Church booleans (\t \f t is 1), so one
+// application reads or writes what takes eight of __builtin_g/p0/p1:
+//
+//   __builtin_getbyte eof w    the next byte, or eof at the end of input
+//   __builtin_putbyte byte w   puts byte out (anything else is ignored), w
+//
+// Both go through the bit streams above, so they mix with the bit builtins.
+static const lmb_hdr_t& eval_builtin(const node_t &node, const shadow_env_t &env) {
+
+    state_t &st = state_t::cur();
+
+    switch (node.kind) {
+
+        case P0:
+            output(0);
+            return force(env[0]);
+
+        case P1:
+            output(1);
+            return force(env[0]);
+
+        case G: {
+            int bit = input();
+            return force(bit == EOF ? env[3] : env[bit+1]);
+        }
+
+        case GETBYTE: {
+            int bit = input();
+            if (bit == EOF)
+                return force(env[1]);
+            // built by applying byte_mk bit by bit, the partial applications
+            // are memoized like any other, so a byte seen before costs lookups
+            lmb_hdr_t part = st.byte_mk;
+            for (int k = 0; k < 7; k++) {
+                gc_root_t root(part.get());
+                part = apply(part, st.bits[bit]);
+                // a byte cut short by the end of input is padded with zeros
+                if ((bit = input()) == EOF)
+                    bit = 0;
+            }
+            gc_root_t root(part.get());
+            return apply(part, st.bits[bit]);
+        }
+
+        default: {
+            assert(node.kind == PUTBYTE);
+            // whatever the program built its byte with, applied to byte_mk it
+            // comes back as the one closure getbyte would have made
+            const lmb_hdr_t &arg = force(env[1]);
+            gc_root_t broot(arg.get());
+            lmb_hdr_t byte = apply(arg, st.byte_mk);
+            if (byte->body != st.byte_body)
+                return force(env[0]);
+            gc_root_t root(byte.get());
+            for (auto &_bit : byte->env) {
+                const lmb_hdr_t &bit = force(_bit);
+                gc_root_t bit_root(bit.get());
+                lmb_hdr_t half = apply(bit, st.bits[1]);
+                gc_root_t half_root(half.get());
+                output(apply(half, st.bits[0]) == st.bits[1]);
+            }
+            return force(env[0]);
+        }
+    }
+}
+
+// }}}
+
+// snapshot_t {{{
+
+// The heap of an engine between two top level expressions, so a later
+// process starts from there instead of evaluating the prelude again. Only
+// pure memo entries are kept, as reset() would, and if the prelude read
+// input it's kept too, to run again on warm memo tables. A run of 64 bit
+// words:
+//
+//   magic
+//   'l' body n arg_map*n | 'a' func arg | 'r' idx | 'b' which
+//                                  exprs, children first
+//   'C' body n env*n               closure, env first
+//   'M' func arg val               pure application
+//   'P' expr arg n env*n           expression left to run, arg ~0 if none
+//   'O' pos val n byte*n           output of the expressions done
+//
+// Exprs and closures are numbered in the order of their records, exprs as
+// they are in heap_t::nodes. Restoring goes through make_expr() and
+// lmb_cache, so a program parsed afterwards lands on the very same exprs,
+// and their closures on the same memo tables.
+struct snapshot_t {
+
+    static const uint64_t magic = 0x3150414e53424d4cULL;    // "LMBSNAP1"
+    static const uint64_t none = ~0ULL;
+
+    vector<uint64_t> words;
+    unordered_map<lmb_idx_t, uint64_t> lmb_ids;
+
+    void expr(const node_t &node, const heap_t &heap) {
+        switch (node.kind) {
+            case LMB:
+                words.insert(words.end(), {'l', node.a, node.len});
+                words.insert(words.end(), heap.arg_maps.begin() + node.b, heap.arg_maps.begin() + node.b + node.len);
+                break;
+            case APPLY: words.insert(words.end(), {'a', node.a, node.b}); break;
+            case REF: words.insert(words.end(), {'r', node.a}); break;
+            case P0: words.insert(words.end(), {'b', '0'}); break;
+            case P1: words.insert(words.end(), {'b', '1'}); break;
+            case G: words.insert(words.end(), {'b', 'g'}); break;
+            case GETBYTE: words.insert(words.end(), {'b', 'r'}); break;
+            case PUTBYTE: words.insert(words.end(), {'b', 'w'}); break;
+        }
+    }
+
+    uint64_t lmb(const lmb_t *lmb) {
+
+        auto it = lmb_ids.find(lmb->idx);
+        if (it != lmb_ids.end())
+            return it->second;
+
+        vector<uint64_t> rec{'C', lmb->body->id, lmb->env.size()};
+        for (auto &sub : lmb->env)
+            rec.push_back(this->lmb(sub.get()));
+
+        words.insert(words.end(), rec.begin(), rec.end());
+        uint64_t id = lmb_ids.size();
+        return lmb_ids[lmb->idx] = id;
+    }
+
+    static bool save(state_t &st, const string &path) {
+
+        snapshot_t snap;
+        snap.words.push_back(magic);
+
+        for (auto &node : st.nodes)
+            snap.expr(node, st);
+        for (auto lmb = st.head; lmb != nullptr; lmb = lmb->next)
+            snap.lmb(lmb);
+
+        for (auto lmb = st.head; lmb != nullptr; lmb = lmb->next)
+            for (auto &ent : lmb->eval_cache.table) {
+                if (!ent.second || !ent.second->second.pure || !ent.second->second.val)
+                    continue;
+                auto arg = snap.lmb_ids.find(ent.second->first);
+                if (arg != snap.lmb_ids.end())
+                    snap.words.insert(snap.words.end(), {'M', snap.lmb_ids[lmb->idx], arg->second,
+                        snap.lmb_ids[ent.second->second.val->idx]});
+            }
+
+        // what read input can't be skipped, it has to run on the input of
+        // the restored run; it's only the warm memo tables then
+        bool skip = !st.io.in_used;
+        for (size_t i = skip ? st.next_prog : 0; i < st.progs.size(); i++) {
+            auto &prog = st.progs[i];
+            snap.words.insert(snap.words.end(), {'P', prog.expr,
+                prog.arg ? snap.lmb_ids[prog.arg->idx] : none, prog.env.size()});
+            for (auto &lmb : prog.env)
+                snap.words.push_back(snap.lmb_ids[lmb->idx]);
+        }
+
+        string out = skip ? st.io.prelude + st.snapshot_out : st.io.prelude;
+        uint64_t pos = skip ? st.io.out_pos : st.io.prelude_pos, val = skip ? st.io.out_val : st.io.prelude_val;
+        snap.words.insert(snap.words.end(), {'O', pos, val, out.size()});
+        snap.words.insert(snap.words.end(), out.begin(), out.end());
+
+        // renamed into place, so a reader never sees half of it
+        string tmp = path + ".tmp" + to_string(getpid());
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const char *buf = (const char*)snap.words.data();
+        size_t left = snap.words.size() * sizeof(uint64_t);
+        while (fd >= 0 && left > 0) {
+            ssize_t n = write(fd, buf, left);
+            if (n <= 0)
+                break;
+            buf += n, left -= n;
+        }
+        if (fd < 0 || ::close(fd) < 0 || left > 0 || rename(tmp.c_str(), path.c_str()) < 0) {
+            cerr << "snapshot: can't write " << path << endl;
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static bool restore(state_t &st, const char *path) {
+
+        int fd = ::open(path, O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) < 0) {
+            cerr << "snapshot: can't open " << path << endl;
+            return false;
+        }
+        size_t size = info.st_size / sizeof(uint64_t);
+        void *addr = size ? mmap(nullptr, size * sizeof(uint64_t), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (addr == MAP_FAILED || ((const uint64_t*)addr)[0] != magic) {
+            cerr << "snapshot: " << path << " is not a snapshot" << endl;
+            if (addr != MAP_FAILED)
+                munmap(addr, size * sizeof(uint64_t));
+            return false;
+        }
+
+        const uint64_t *words = (const uint64_t*)addr;
+        vector<expr_id_t> exprs;
+        vector<lmb_hdr_t> lmbs;
+        vector<prog_t> progs;
+        size_t off = 1;
+        bool bad = false;
+
+        auto next = [&]() -> uint64_t {
+            if (off >= size) {
+                bad = true;
+                return 0;
+            }
+            return words[off++];
+        };
+        auto next_expr = [&]() -> expr_id_t {
+            uint64_t id = next();
+            return id < exprs.size() ? exprs[id] : (bad = true, 0);
+        };
+        auto next_lmb = [&]() -> lmb_hdr_t {
+            uint64_t id = next();
+            return id < lmbs.size() ? lmbs[id] : (bad = true, nullptr);
+        };
+        auto next_env = [&](env_t &env) {
+            uint64_t n = next();
+            for (uint64_t i = 0; i < n && !bad; i++)
+                env.push_back(next_lmb());
+        };
+
+        while (off < size && !bad) {
+            switch (next()) {
+                case 'l': {
+                    auto body = next_expr();
+                    arg_map_t arg_map(next());
+                    for (auto &idx : arg_map)
+                        idx = next();
+                    if (!bad)
+                        exprs.push_back(lmb_expr(body, arg_map));
+                    break;
+                }
+                case 'a': {
+                    auto func = next_expr();
+                    auto arg = next_expr();
+                    if (!bad)
+                        exprs.push_back(apply_expr(func, arg));
+                    break;
+                }
+                case 'r':
+                    exprs.push_back(ref_expr(next()));
+                    break;
+                case 'b':
+                    switch (next()) {
+                        case '0': exprs.push_back(builtin_expr(P0)); break;
+                        case '1': exprs.push_back(builtin_expr(P1)); break;
+                        case 'g': exprs.push_back(builtin_expr(G)); break;
+                        case 'r': exprs.push_back(builtin_expr(GETBYTE)); break;
+                        case 'w': exprs.push_back(builtin_expr(PUTBYTE)); break;
+                        default: bad = true;
+                    }
+                    break;
+                case 'C': {
+                    const expr_t &body = st.exprs[next_expr()];
+                    env_t env;
+                    next_env(env);
+                    if (bad)
+                        break;
+                    env_key_t key(env.size());
+                    for (auto &lmb : env)
+                        key.push_back(lmb->idx);
+                    auto &ref = body.lmb_cache[key];
+                    if (ref == nullptr)
+                        ref = make_lmb(&body, move(env));
+                    lmbs.push_back(ref);
+                    break;
+                }
+                case 'M': {
+                    auto func = next_lmb();
+                    auto arg = next_lmb();
+                    auto val = next_lmb();
+                    if (!bad)
+                        func->eval_cache[arg->idx] = memo_t{val, true};
+                    break;
+                }
+                case 'P': {
+                    prog_t prog;
+                    prog.expr = next_expr();
+                    if (off < size && words[off] == none)
+                        ++off;
+                    else
+                        prog.arg = next_lmb();
+                    next_env(prog.env);
+                    progs.push_back(move(prog));
+                    break;
+                }
+                case 'O': {
+                    st.io.prelude_pos = next();
+                    st.io.prelude_val = next();
+                    uint64_t n = next();
+                    for (uint64_t i = 0; i < n && !bad; i++)
+                        st.io.prelude += char(next());
+                    break;
+                }
+                default:
+                    bad = true;
+            }
+        }
+
+        munmap(addr, size * sizeof(uint64_t));
+        if (bad) {
+            cerr << "snapshot: " << path << " is corrupt" << endl;
+            return false;
+        }
+        st.progs.insert(st.progs.end(), progs.begin(), progs.end());
+        return true;
+    }
+};
+const uint64_t snapshot_t::magic;
+const uint64_t snapshot_t::none;
+
+// }}}
+
+// engine_t {{{
+
+// makes an engine current for the duration of a call into it
+struct use_t {
+    heap_t *prev;
+    use_t(heap_t &heap) : prev(heap_t::current) { heap_t::current = &heap; }
+    ~use_t() { heap_t::current = prev; }
+};
+
+engine_t::state_t::~state_t() {
+
+    // closures refer to each other through memo tables and exprs refer to
+    // closures through lmb_cache, so cut every link before releasing any
+    vector<gc_t::memo_ent_t> vals;
+    vector<env_cache_t::ent_hdr_t> lmbs;
+
+    progs.clear();
+    for (auto &pair : builtins)
+        --pair.second->roots;
+    builtins.clear();
+    for (auto lmb : {&bits[0], &bits[1], &byte_mk}) {
+        --(*lmb)->roots;
+        lmb->reset();
+    }
+
+    for (auto lmb = head; lmb != nullptr; lmb = lmb->next) {
+        for (auto &ent : lmb->eval_cache.table)
+            if (ent.second)
+                vals.push_back(move(ent.second));
+        lmb->eval_cache = decltype(lmb->eval_cache)();
+    }
+    for (auto &expr : exprs)
+        for (auto cache : {&expr.lmb_cache, &expr.thunk_cache, &expr.call_cache})
+            cache->erase_if([](const env_cache_t::ent_t&) { return true; }, lmbs);
+    for (auto &ent : gc.limbo)
+        vals.push_back(move(ent));
+    gc.limbo.clear();
+
+    vals.clear();
+    lmbs.clear();
+}
+
+engine_t::engine_t() : st(new state_t()) {
+
+    use_t use(*st);
+
+    // made through lmb_cache like any other closure, so memo_file_t can
+    // rebuild results that refer to them
+    auto builtin = [this](expr_id_t id) -> lmb_hdr_t {
+        const expr_t &body = st->exprs[id];
+        return body.lmb_cache[env_key_t(0)] = make_lmb(&body, env_t{});
+    };
+
+    auto &env = st->builtins;
+    env["__builtin_p0"] = builtin(builtin_expr(P0));
+    env["__builtin_p1"] = builtin(builtin_expr(P1));
+    env["__builtin_g"] = builtin(
+        lmb_expr(
+           lmb_expr(
+               lmb_expr(
+                    builtin_expr(G),
+                    arg_map_t{1, 2, 0}),
+                arg_map_t{1, 0}),
+            arg_map_t{0}));
+    env["__builtin_getbyte"] = builtin(lmb_expr(builtin_expr(GETBYTE), arg_map_t{0}));
+    env["__builtin_putbyte"] = builtin(lmb_expr(builtin_expr(PUTBYTE), arg_map_t{0}));
+    for (auto &pair : env)
+        ++pair.second->roots;
+
+    auto closed = [](const char *src) -> lmb_hdr_t {
+        istringstream stm(src);
+        tokenizer_t toks(stm);
+        map<string, size_t> ref;
+        lmb_hdr_t none;
+        env_t empty;
+        return eval(parser_t().parse_single_expr(toks, ref), shadow_env_t{none, empty});
+    };
+    st->bits[0] = closed("\\t \\f f");
+    st->bits[1] = closed("\\t \\f t");
+    st->byte_mk = closed("\\b7 \\b6 \\b5 \\b4 \\b3 \\b2 \\b1 \\b0 \\f f b7 b6 b5 b4 b3 b2 b1 b0");
+    for (auto lmb : {&st->bits[0], &st->bits[1], &st->byte_mk})
+        ++(*lmb)->roots;
+    lmb_hdr_t part = st->byte_mk;
+    for (int k = 0; k < 8; k++)
+        part = apply(part, st->bits[0]);
+    st->byte_body = part->body;
+    // what the program defines is labelled by the program
+    st->sources.clear();
+
+    bind([]() { return cin.get(); }, [](int c) { cout.put(char(c)); cout.flush(); });
+}
+
+engine_t::~engine_t() {
+    use_t use(*st);
+    st->memo_file.close();
+    st.reset();
+}
+
+bool engine_t::load(istream &src) {
+
+    use_t use(*st);
+    tokenizer_t toks(src);
+    parser_t parser;
+
+    prog_t prog;
+    while (parser.parse_once(toks, st->builtins, prog))
+        st->progs.push_back(prog);
+
+    return toks.peak() == "";
+}
+
+void engine_t::bind(getc_t getc, putc_t putc) {
+    st->io.getc = move(getc);
+    st->io.putc = move(putc);
+}
+
+// Limits count from here, see limits_t; the stack from the end of the
+// fiber's, for a run on it, or else this thread's, less stack_margin.
+static void begin_run(state_t &st, size_t budget, bool on_fiber) {
+
+    limits_t &lim = st.limits;
+    if (!budget)
+        budget = lim.max_steps;
+    lim.steps_end = budget ? st.steps + budget : SIZE_MAX;
+    lim.deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(lim.timeout));
+    lim.stack_end = nullptr;
+    void *stack = on_fiber ? st.fiber.stack : nullptr;
+    size_t stack_size = fiber_t::stack_size;
+    pthread_attr_t attr;
+    if (!on_fiber && pthread_getattr_np(pthread_self(), &attr) == 0) {
+        if (pthread_attr_getstack(&attr, &stack, &stack_size) != 0)
+            stack = nullptr;
+        pthread_attr_destroy(&attr);
+    }
+    if (stack != nullptr)
+        lim.stack_end = (const char*)stack + min(stack_size / 4, limits_t::stack_margin);
+    st.step_limit = lim.steps_end;
+    if (lim.timeout > 0 || lim.max_heap_kb || st.metrics.interval > 0)
+        st.step_limit = min(st.step_limit, st.steps + limits_t::check_every);
+}
+
+// the top level expressions left, see engine_t::run
+static engine_t::status_t run_progs(state_t &st) {
+
+    if (st.next_prog == 0) {
+        for (auto chr : st.io.prelude)
+            st.io.putc((unsigned char)chr);
+        st.io.out_pos = st.io.prelude_pos;
+        st.io.out_val = st.io.prelude_val;
+    }
+
+    try {
+        for (;; st.next_prog++) {
+            if (!st.snapshot_path.empty()) {
+                if (st.next_prog >= min(st.snapshot_after, st.progs.size())) {
+                    snapshot_t::save(st, st.snapshot_path);
+                    st.snapshot_path.clear();
+                    st.io.tee = nullptr;
+                } else
+                    st.io.tee = &st.snapshot_out;
+            }
+            if (st.next_prog >= st.progs.size())
+                break;
+            auto &prog = st.progs[st.next_prog];
+            gc_root_t root(prog.arg.get());
+            st.pure = true;
+            eval(prog.expr, shadow_env_t{prog.arg, prog.env});
+        }
+    } catch (const limit_t &limit) {
+        // closures only the stack held are gone, and their memo tables
+        // with them, so there is nothing to resume from
+        st.aborted = limit.status;
+    }
+
+    // the last line of a run, however short
+    if (st.metrics.os != nullptr)
+        write_metrics(st);
+    return st.aborted;
+}
+
+// where a fiber starts; heap_t::current is the engine resuming it
+static void fiber_main() {
+    state_t &st = state_t::cur();
+    run_progs(st);
+    st.fiber.running = false;
+}
+
+engine_t::status_t engine_t::run(size_t budget) {
+
+    use_t use(*st);
+    if (st->aborted != DONE)
+        return st->aborted;
+    assert(!st->fiber.running);
+
+    begin_run(*st, budget, false);
+    return run_progs(*st);
+}
+
+engine_t::status_t engine_t::start(size_t budget) {
+
+    use_t use(*st);
+    if (st->aborted != DONE)
+        return st->aborted;
+    assert(!st->fiber.running);
+
+    fiber_t &fib = st->fiber;
+    if (fib.stack == nullptr) {
+        void *stack = mmap(nullptr, fiber_t::stack_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (stack == MAP_FAILED)
+            return STACK;
+        fib.stack = (char*)stack;
+    }
+
+    begin_run(*st, budget, true);
+    getcontext(&fib.self);
+    fib.self.uc_stack.ss_sp = fib.stack;
+    fib.self.uc_stack.ss_size = fiber_t::stack_size;
+    fib.self.uc_link = &fib.caller;
+    makecontext(&fib.self, fiber_main, 0);
+    fib.running = true;
+    return resume();
+}
+
+engine_t::status_t engine_t::resume() {
+
+    use_t use(*st);
+    fiber_t &fib = st->fiber;
+    if (!fib.running)
+        return st->aborted;
+
+    swapcontext(&fib.caller, &fib.self);
+    return fib.running ? SUSPENDED : st->aborted;
+}
+
+void engine_t::reset() {
+
+    use_t use(*st);
+
+    // released after the walk, dying closures unlink themselves
+    vector<gc_t::memo_ent_t> dropped;
+    for (auto lmb = st->head; lmb != nullptr; lmb = lmb->next)
+        lmb->eval_cache.erase_if([](const pair<lmb_idx_t, memo_t> &ent) {
+            return !ent.second.pure;
+        }, dropped);
+    dropped.clear();
+    st->memo_file.sync();
+
+    st->pure = true;
+    st->io.reset();
+    st->next_prog = 0;
+    st->aborted = DONE;
+}
+
+void engine_t::snapshot(const char *path, size_t after) {
+    st->snapshot_path = path;
+    st->snapshot_after = after;
+}
+
+bool engine_t::restore(const char *path) {
+    use_t use(*st);
+    return snapshot_t::restore(*st, path);
+}
+
+void engine_t::lazy() {
+    st->lazy = true;
+}
+
+void engine_t::curried() {
+    st->uncurry = false;
+}
+
+void engine_t::limits(size_t max_steps, size_t max_heap_mb, double timeout, double idle) {
+    st->limits.max_steps = max_steps;
+    st->limits.max_heap_kb = max_heap_mb * 1024;
+    st->limits.timeout = timeout;
+    st->limits.idle = idle;
+}
+
+void engine_t::gc(size_t threshold) {
+    st->gc.enabled = true;
+    if (threshold)
+        st->gc.threshold = threshold;
+}
+
+bool engine_t::open_memo_file(const char *path, size_t min_steps) {
+    st->memo_file.min_steps = min_steps;
+    return st->memo_file.open(path);
+}
+
+void engine_t::close_memo_file() {
+    st->memo_file.close();
+}
+
+bool engine_t::read_memo_policy(const char *path) {
+
+    ifstream fin(path);
+    string line;
+    while (getline(fin, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        char *end;
+        uint64_t fp = strtoull(line.c_str(), &end, 16);
+        if (end == line.c_str()) {
+            cerr << "memo policy: bad line in " << path << ": " << line << endl;
+            return false;
+        }
+        st->memo_hints.insert(fp);
+    }
+
+    for (auto &expr : st->exprs)
+        if (st->memo_hints.count(expr.fp))
+            expr.memo.off = true;
+    return true;
+}
+
+bool engine_t::write_memo_policy(const char *path) const {
+
+    // hints for bodies this engine doesn't have are kept
+    set<uint64_t> fps, seen;
+    for (auto &expr : st->exprs) {
+        seen.insert(expr.fp);
+        if (expr.memo.off)
+            fps.insert(expr.fp);
+    }
+    for (auto fp : st->memo_hints)
+        if (!seen.count(fp))
+            fps.insert(fp);
+
+    ofstream fout(path);
+    fout << "# lambda bodies not worth memoizing, by fingerprint" << endl;
+    for (auto fp : fps)
+        fout << hex << setw(16) << setfill('0') << fp << endl;
+    if (!fout) {
+        cerr << "memo policy: can't write " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+void engine_t::print_stats(ostream &os) const {
+    os << "applications: " << st->steps << " evaluated" << endl;
+    os << "closures: " << st->gidx << " allocated, " << st->live << " live" << endl;
+    if (st->lazy)
+        os << "thunks: " << st->thunks << " made, " << st->forced << " forced" << endl;
+    else if (st->uncurry)
+        os << "calls: " << st->calls << " taking several arguments, " << st->call_hits << " memoized" << endl;
+    size_t unmemoized = 0;
+    for (auto &expr : st->exprs)
+        unmemoized += expr.memo.off;
+    os << "memo policy: " << unmemoized << " bodies unmemoized, " << st->unmemoized << " applications not memoized" << endl;
+    os << "gc: " << st->gc.collections << " collections, " << st->gc.freed << " closures freed, "
+       << "pause " << st->gc.pause_total << " ms total, " << st->gc.pause_max << " ms max" << endl;
+    if (st->memo_file.enabled)
+        os << "memo file: " << st->memo_file.hits << " hits, " << st->memo_file.misses << " misses, "
+           << st->memo_file.written << " records written" << endl;
+}
+
+void engine_t::print_heap_report(ostream &os, size_t top) const {
+    heap_report(*st, os, top);
+}
+
+void engine_t::heap_report_on_request(ostream &os, size_t top) {
+    st->heap_report_os = &os;
+    st->heap_report_top = top;
+}
+
+void engine_t::request_heap_report() {
+    heap_report_requested = 1;
+}
+
+void engine_t::metrics(ostream &os, double interval) {
+    metrics_t &met = st->metrics;
+    met.os = &os;
+    met.interval = interval;
+    met.start = met.last = chrono::steady_clock::now();
+    met.next = met.start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(interval));
+}
+
+void engine_t::request_metrics() {
+    metrics_requested = 1;
+}
+
+void engine_t::print_hash_stats(ostream &os) const {
+
+    hash_stats_t exprs, lmbs, evals, calls;
+
+    exprs.add(st->node_ids.table);
+    for (auto &expr : st->exprs) {
+        lmbs.add(expr.lmb_cache.table);
+        if (expr.call_cache.size > 0)
+            calls.add(expr.call_cache.table);
+    }
+    for (auto lmb = st->head; lmb != nullptr; lmb = lmb->next)
+        evals.add(lmb->eval_cache.table);
+
+    exprs.print(os, "expr_cache");
+    lmbs.print(os, "lmb_cache");
+    evals.print(os, "eval_cache");
+    calls.print(os, "call_cache");
+}
+
+// }}}
@@ -1,477 +1,659 @@
+#include "engine.hpp"
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <deque>
-#include <map>
-#include <tuple>
-#include <utility>
+#include <string>
 #include <vector>
-#include <memory>
-#include <cctype>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <new>
 #include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 using namespace std;
 
-// hash_map_t {{{
-
-template <typename K, typename V, typename H=hash<K>>
-struct hash_map_t {
-
-    H hasher;
-    size_t size;
-    vector<pair<size_t, unique_ptr<pair<K, V>>>> table;
-
-    hash_map_t() : size(0), table(1) {}
-
-    template <class KU>
-    V& operator[](KU&& k) {
-
-        size_t idx;
-        const size_t hash_val = hasher(k);
-        const size_t mask = table.size() - 1;
-
-        // exist?
-        for (idx = hash_val & mask; table[idx].second; idx = (idx + 1) & mask)
-            if (table[idx].first == hash_val && table[idx].second->first == k)
-                return table[idx].second->second;
-
-        // insert
-        ++size;
-        table[idx] = move(make_pair(hash_val, unique_ptr<pair<K, V>>(new pair<K, V>(forward<KU>(k), V()))));
-        V& retv = table[idx].second->second;
-
-        // extend if load >= 2/3
-        if (size * 3 >= table.size() * 2)
-            _extend();
+// why a run was abandoned, see engine_t::limits; lmb exits with 1 + the
+// status, so 2 for steps, 3 memory, 4 time and 5 stack
+static const char* abort_reason(engine_t::status_t status) {
+    switch (status) {
+        case engine_t::BUDGET: return "out of steps";
+        case engine_t::MEMORY: return "out of memory";
+        case engine_t::TIMEOUT: return "out of time";
+        case engine_t::STACK: return "out of stack";
+        default: return "done";
+    }
+}
 
-        return retv;
+// batch {{{
+
+// One parsed program run over many inputs, each writing its own output.
+// Workers are forked once the program is parsed, so they share the expr
+// DAG copy-on-write, and take inputs off a shared counter. Between inputs
+// a worker drops only the impure memo entries; pure results stay warm for
+// every later input (and, through --memo-file, for the other workers from
+// their next input on).
+struct batch_t {
+
+    static string out_dir;
+    static size_t jobs;
+
+    // fcrh.in -> out_dir/fcrh.out
+    static string out_path(const string &in_path) {
+        string name = in_path.substr(in_path.find_last_of('/') + 1);
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, ".in") == 0)
+            name.resize(name.size() - 3);
+        return out_dir + "/" + name + ".out";
     }
 
-    void _extend() {
+    static bool run_one(engine_t &engine, const string &in_path) {
 
-        decltype(table) ntable(table.size() * 2);
-        const size_t nmask = ntable.size() - 1;
+        ifstream fin(in_path, ios::binary);
+        ofstream fout(out_path(in_path), ios::binary);
+        if (!fin || !fout) {
+            cerr << "batch: can't open " << (fin ? out_path(in_path) : in_path) << endl;
+            return false;
+        }
 
-        for (auto &ent : table)
-            if (ent.second) {
-                size_t idx = ent.first & nmask;
-                while (ntable[idx].second)
-                    idx = (idx + 1) & nmask;
-                ntable[idx] = move(ent);
-            }
+        engine.bind([&]() { return fin.get(); }, [&](int c) { fout.put(char(c)); });
+        auto status = engine.run();
+        engine.reset();
 
-        table.swap(ntable);
+        if (status != engine_t::DONE)
+            cerr << "batch: " << in_path << " aborted, " << abort_reason(status) << endl;
+        return status == engine_t::DONE;
     }
-};
 
-namespace std {
+    static int run(engine_t &engine, const vector<string> &inputs, const function<void()> &done) {
 
-    constexpr static size_t _combine(size_t a, size_t b) {
-        return a * 17 + b;
-    }
+        mkdir(out_dir.c_str(), 0755);
 
-    template <typename U, typename V>
-    struct hash<pair<U, V>> {
-        hash<U> uhash;
-        hash<V> vhash;
-        size_t operator()(const pair<U, V> &p) const {
-            return _combine(uhash(p.first), vhash(p.second));
+        if (jobs <= 1) {
+            bool ok = true;
+            for (auto &in_path : inputs)
+                ok = run_one(engine, in_path) && ok;
+            done();
+            return ok ? 0 : 1;
         }
-    };
 
-    template <typename T, size_t idx=tuple_size<T>::value>
-    struct _tuple_hash {
-        _tuple_hash<T, idx-1> uhash;
-        hash<typename tuple_element<idx-1, T>::type> vhash;
-        size_t operator()(const T& t) const {
-            return _combine(uhash(t), vhash(get<idx-1>(t)));
+        void *mem = mmap(nullptr, sizeof(atomic<size_t>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            cerr << "batch: can't share the input counter" << endl;
+            return 1;
         }
-    };
-    template <typename T>
-    struct _tuple_hash<T, 0> {
-        size_t operator()(const T& t) const { return 0; }
-    };
-    template <typename... Args>
-    struct hash<tuple<Args...>> : _tuple_hash<tuple<Args...>> {};
-
-    template <typename V>
-    struct hash<vector<V>> {
-        hash<V> vhash;
-        size_t operator()(const vector<V> &vs) const {
-            size_t retv = 0;
-            for (auto &v : vs)
-                retv = _combine(retv, vhash(v));
-            return retv;
-        }
-    };
-}
-
-// }}}
-
-// lmb_t env_t expr_t {{{
-
-struct lmb_t;
-using lmb_idx_t = unsigned long;
-using lmb_hdr_t = shared_ptr<const lmb_t>;
+        auto next = new (mem) atomic<size_t>(0);
 
-using env_t = vector<lmb_hdr_t>;
-using env_idx_t = vector<lmb_idx_t>;
-
-struct shadow_env_t {
-    const lmb_hdr_t &shadow_val;
-    const env_t &orgi_env;
-    const lmb_hdr_t& operator[](int idx) const {
-        return idx == 0 ? shadow_val : orgi_env[idx-1];
-    }
-};
-
-struct expr_t {
-    mutable hash_map_t<env_idx_t, lmb_hdr_t> lmb_cache;
-    virtual const lmb_hdr_t& eval(const shadow_env_t &env) const = 0;
-    virtual ~expr_t() {};
-};
-using expr_hdr_t = shared_ptr<const expr_t>;
-
-template <typename T, typename... Args>
-struct cached_expr_t : public expr_t {
-
-    using key_t = tuple<Args...>;
-    static hash_map_t<key_t, expr_hdr_t> expr_cache;
-
-    static expr_hdr_t create(const Args&... args) {
-        auto &ref = expr_cache[key_t(args...)];
-        if (ref == nullptr)
-            return ref = make_shared<T>(args...);
-        return ref;
+        cout.flush();
+        cerr.flush();
+        vector<pid_t> workers;
+        for (size_t k = 0; k < jobs && k < inputs.size(); k++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                bool ok = true;
+                for (size_t i; (i = next->fetch_add(1)) < inputs.size(); )
+                    ok = run_one(engine, inputs[i]) && ok;
+                done();
+                cerr.flush();
+                _exit(ok ? 0 : 1);
+            }
+            if (pid < 0)
+                cerr << "batch: fork failed, running with " << k << " workers" << endl;
+            else
+                workers.push_back(pid);
+        }
+        if (workers.empty())
+            return 1;
+
+        int retv = 0;
+        for (auto pid : workers) {
+            int status;
+            if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                retv = 1;
+        }
+        return retv;
     }
 };
-template <typename T, typename... Args>
-hash_map_t<typename cached_expr_t<T, Args...>::key_t, expr_hdr_t> cached_expr_t<T, Args...>::expr_cache;
-
-struct lmb_t {
-
-    static lmb_idx_t gidx;
-
-    const expr_hdr_t body;
-    const env_t env;
-    const lmb_idx_t idx;
-    mutable hash_map_t<lmb_idx_t, lmb_hdr_t> eval_cache;
-
-    template <typename EU>
-    lmb_t(const expr_hdr_t& _body, EU&& _env) :
-        body(_body), env(forward<EU>(_env)), idx(gidx++) {}
-};
-lmb_idx_t lmb_t::gidx = 0;
-
-template <typename... Args>
-lmb_hdr_t make_lmb(Args&&... args) {
-    return make_shared<const lmb_t>(forward<Args>(args)...);
-}
+string batch_t::out_dir;
+size_t batch_t::jobs = 1;
 
 // }}}
 
-// X_expr_t {{{
-
-using arg_map_t = vector<size_t>;
-struct lmb_expr_t : public cached_expr_t<lmb_expr_t, expr_hdr_t, arg_map_t> {
-
-    const expr_hdr_t body;
-    const arg_map_t arg_map;
-
-    lmb_expr_t(const expr_hdr_t &_body, const arg_map_t &_arg_map) :
-        body(_body), arg_map(_arg_map) {}
-
-    virtual const lmb_hdr_t& eval(const shadow_env_t &env) const {
-
-        env_idx_t ienv;
-        ienv.reserve(arg_map.size());
-        for (auto idx : arg_map)
-            ienv.emplace_back(env[idx]->idx);
-
-        auto &ref = body->lmb_cache[move(ienv)];
-        if (ref == nullptr) {
-
-            env_t nenv;
-            nenv.reserve(arg_map.size());
-            for (auto idx : arg_map)
-                nenv.emplace_back(env[idx]);
-
-            ref = make_lmb(body, move(nenv));
+// serve {{{
+
+// Programs stay loaded, with their memo tables warm, and are run on
+// request over a Unix socket. A request is the program id (its file name
+// without .lmb) on a line, then the input until the client shuts down its
+// side; the reply is "ok" or "error <why>" on a line, then the output as
+// it's produced, each 0xff byte doubled, and last 0xff and how the run
+// ended as a digit, the engine_t::status_t, so a run stopped at a limit
+// can be told from one that had that much to say. The id ".stats" replies
+// with the latency table instead.
+// Requests are served together in one thread, each on an engine of its
+// own: a run waiting for input is suspended (see engine_t::start) while
+// the others go on, and resumed once its socket has more, or once it has
+// waited idle_timeout seconds, for the engine to stop it.
+struct serve_t {
+
+    // a request, from accept() to the last byte of the reply
+    struct conn_t {
+
+        int fd;
+        char in_buf[4096];
+        size_t in_pos = 0, in_len = 0;
+        // what the socket didn't take yet; it grows as long as the client
+        // doesn't read, the run isn't held up
+        string out_buf;
+        bool in_eof = false, dead = false;
+        size_t in_total = 0, out_total = 0;
+
+        string id;
+        bool have_id = false;
+        engine_t *engine = nullptr;
+        engine_t::status_t status = engine_t::DONE;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now(), suspended;
+
+        conn_t(int _fd) : fd(_fd) {}
+
+        ~conn_t() {
+            close(fd);
         }
 
-        return ref;
-    }
-};
-
-struct apply_expr_t : public cached_expr_t<apply_expr_t, expr_hdr_t, expr_hdr_t> {
-
-    const expr_hdr_t func;
-    const expr_hdr_t arg;
-
-    apply_expr_t(const expr_hdr_t &_func, const expr_hdr_t &_arg) :
-        func(_func), arg(_arg) {}
-
-    virtual const lmb_hdr_t& eval(const shadow_env_t &env) const {
-        auto& lfunc = func->eval(env);
-        auto& larg = arg->eval(env);
-        auto& ref = lfunc->eval_cache[larg->idx];
-        if (ref == nullptr)
-            ref = lfunc->body->eval(shadow_env_t{larg, lfunc->env});
-        return ref;
-    }
-};
-
-struct ref_expr_t : public cached_expr_t<ref_expr_t, size_t> {
-
-    const size_t ref_idx;
-
-    ref_expr_t(size_t _ref_idx) : ref_idx(_ref_idx) {}
+        // engine_t::AGAIN when nothing can be read without blocking
+        int getc() {
+            if (in_pos == in_len) {
+                // the client may wait on what's been output so far
+                flush();
+                if (in_eof)
+                    return EOF;
+                ssize_t got;
+                while ((got = read(fd, in_buf, sizeof(in_buf))) < 0 && errno == EINTR);
+                if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return engine_t::AGAIN;
+                if (got <= 0) {
+                    in_eof = true;
+                    return EOF;
+                }
+                in_pos = 0, in_len = got;
+                in_total += got;
+            }
+            return (unsigned char)in_buf[in_pos++];
+        }
 
-    virtual const lmb_hdr_t& eval(const shadow_env_t &env) const {
-        return env[ref_idx];
-    }
-};
+        // the id line, read as far as it can be; engine_t::AGAIN until
+        // it's all there
+        int getline() {
+            int c;
+            while ((c = getc()) != EOF && c != engine_t::AGAIN && c != '\n')
+                id += char(c);
+            have_id = c == '\n';
+            return c;
+        }
 
-// }}}
+        void putc(int c) {
+            out_buf += char(c);
+            if (c == 0xff)
+                out_buf += char(c);
+            out_total++;
+            if (out_buf.size() >= 4096)
+                flush();
+        }
 
-// tokenizer {{{
+        // the end of the reply
+        void end(engine_t::status_t status) {
+            out_buf += '\xff';
+            out_buf += char('0' + status);
+        }
 
-struct tokenizer_t {
+        void puts(const string &str) {
+            for (auto chr : str)
+                putc(chr);
+        }
 
-    istream &stm;
-    string spe_chars;
-    deque<string> toks;
+        void flush() {
+            size_t off = 0;
+            while (off < out_buf.size() && !dead) {
+                ssize_t put = write(fd, out_buf.data() + off, out_buf.size() - off);
+                if (put < 0 && errno == EINTR)
+                    continue;
+                if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+                // the client went away, the run still finishes
+                if (put <= 0)
+                    dead = true;
+                else
+                    off += put;
+            }
+            out_buf.erase(0, dead ? out_buf.size() : off);
+        }
 
-    tokenizer_t(istream &_stm) : stm(_stm), spe_chars("()\\") {}
+        // replied to, and all of it written
+        bool over() const {
+            return have_id && engine == nullptr && status != engine_t::SUSPENDED && out_buf.empty();
+        }
+    };
 
-    string peak() {
-        while (toks.empty())
-            if (!_read_more())
-                return "";
-        return toks.front();
-    }
+    struct latency_t {
+
+        vector<double> ms;
+
+        void print(ostream &os, const string &name) {
+            if (ms.empty())
+                return;
+            vector<double> sorted(ms);
+            sort(sorted.begin(), sorted.end());
+            double sum = 0;
+            for (auto val : sorted)
+                sum += val;
+            auto pct = [&](double p) { return sorted[size_t(p * (sorted.size() - 1))]; };
+            os << name << ": " << sorted.size() << " runs, mean " << sum / sorted.size()
+               << " ms, p50 " << pct(0.5) << " ms, p99 " << pct(0.99) << " ms, max " << sorted.back() << " ms" << endl;
+        }
+    };
 
-    string pop() {
-        string retv = peak();
-        toks.pop_front();
-        return retv;
+    static volatile sig_atomic_t stopping;
+    // as given to engine_t::limits
+    double idle_timeout = 0;
+
+    // every engine of each program, those not running a request, and how
+    // to load another when a request finds none
+    map<string, vector<engine_t*>> engines;
+    map<string, vector<engine_t*>> idle;
+    map<string, string> paths;
+    function<engine_t*(const char*)> load;
+
+    map<string, latency_t> latency;
+
+    // prog/fcrh.lmb -> fcrh
+    static string prog_id(const string &path) {
+        string name = path.substr(path.find_last_of('/') + 1);
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".lmb") == 0)
+            name.resize(name.size() - 4);
+        return name;
     }
 
-    bool _read_more() {
-
-        string line;
-        do {
-            if (!getline(stm, line))
-                return false;
-        } while (line.length() == 0 || _is_comment(line));
-
-        _parse(line);
+    bool add(const string &path) {
+        string id = prog_id(path);
+        engine_t *engine = load(path.c_str());
+        if (engine == nullptr)
+            return false;
+        paths[id] = path;
+        engines[id].push_back(engine);
+        idle[id].push_back(engine);
         return true;
     }
 
-    bool _is_comment(std::string &str) {
-        for (auto chr : str)
-            if (!isspace(chr))
-                return chr == '#';
-        return false;
-    }
-
-    void _parse(string &line) {
-
-        stringstream buf(line);
-
-        while (true) {
-
-            char c;
-            do {
-                if (!buf.get(c))
-                    return;
-            } while (isspace(c));
-
-            if (spe_chars.find(c) != string::npos) {
-                toks.push_back(string(1, c));
-                continue;
-            }
-
-            // identity
-            string tok;
-            do {
-                tok += c;
-                if (!buf.get(c)) {
-                    toks.push_back(tok);
+    // takes the request as far as it goes without blocking: the id line,
+    // then the run, started or resumed
+    void step(conn_t &conn) {
+
+        if (!conn.have_id) {
+            int c = conn.getline();
+            if (c == engine_t::AGAIN)
+                return;
+            if (c == EOF) {
+                conn.have_id = true;
+                conn.puts("error no program id\n");
+            } else if (conn.id == ".stats") {
+                conn.puts("ok\n");
+                for (auto &ent : latency) {
+                    ostringstream os;
+                    ent.second.print(os, ent.first);
+                    conn.puts(os.str());
+                }
+                conn.end(engine_t::DONE);
+            } else if (engines.count(conn.id) == 0) {
+                conn.puts("error unknown program " + conn.id + "\n");
+            } else {
+                auto &free = idle[conn.id];
+                if (free.empty() && add(paths[conn.id]))
+                    cerr << "serve: " << conn.id << ", " << engines[conn.id].size() << " engines" << endl;
+                if (free.empty()) {
+                    conn.puts("error can't load " + conn.id + "\n");
                     return;
                 }
-            } while (!isspace(c) && spe_chars.find(c) == string::npos);
-
-            toks.push_back(tok);
-            buf.unget();
+                conn.puts("ok\n");
+                conn.engine = free.back();
+                free.pop_back();
+                conn.engine->bind([&conn]() { return conn.getc(); }, [&conn](int c) { conn.putc(c); });
+                conn.status = conn.engine->start();
+            }
+        } else if (conn.engine != nullptr)
+            conn.status = conn.engine->resume();
+        if (conn.status == engine_t::SUSPENDED)
+            conn.suspended = chrono::steady_clock::now();
+
+        if (conn.engine != nullptr && conn.status != engine_t::SUSPENDED) {
+            conn.end(conn.status);
+            conn.engine->reset();
+            idle[conn.id].push_back(conn.engine);
+            conn.engine = nullptr;
         }
+        conn.flush();
     }
 
-};
-
-// }}}
-
-// parser {{{
+    void finish(conn_t &conn) {
 
-struct parser_t {
-
-    parser_t() {}
-
-    expr_hdr_t parse_single_expr(tokenizer_t &tok, map<string, size_t> &ref) {
-
-        string token = tok.pop();
-        assert(token != "");
-
-        if (token == "(") {
-            auto retv = parse_expr(tok, ref);
-            assert(tok.peak() == ")");
-            tok.pop();
-            return retv;
-        }
-        if (token != "\\") {
-            if (!ref.count(token))
-                ref.insert(make_pair(token, ref.size()));
-            return ref_expr_t::create(ref[token]);
-        }
-
-        // lambda
+        if (engines.count(conn.id) == 0)
+            return;
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - conn.start).count();
+        latency[conn.id].ms.push_back(ms);
+        cerr << "serve: " << conn.id << ", " << conn.in_total - conn.id.size() - 1 << " bytes in, " << conn.out_total << " bytes out, "
+             << ms << " ms" << (conn.dead ? " (client gone)" : "")
+             << (conn.status != engine_t::DONE ? string(" (aborted, ") + abort_reason(conn.status) + ")" : "") << endl;
+    }
 
-        map<string, size_t> nref;
-        string arg = tok.pop();
-        assert(arg != "(" && arg != ")" && arg != "\\");
-        nref[arg] = 0;
-        auto body = parse_expr(tok, nref);
+    int run(const string &path) {
 
-        nref.erase(arg);
-        vector<size_t> arg_map(nref.size());
-        for (auto pair : nref) {
-            if (!ref.count(pair.first))
-                ref.insert(make_pair(pair.first, ref.size()));
-            arg_map[pair.second-1] = ref[pair.first];
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            cerr << "serve: socket path too long" << endl;
+            return 1;
         }
+        strcpy(addr.sun_path, path.c_str());
 
-        return lmb_expr_t::create(body, arg_map);
-    }
-
-    expr_hdr_t parse_expr(tokenizer_t &tok, map<string, size_t> &ref) {
-
-        auto func = parse_single_expr(tok, ref);
-        while (tok.peak() != ")" && tok.peak() != "") {
-            auto arg = parse_single_expr(tok, ref);
-            func = apply_expr_t::create(func, arg);
+        int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        unlink(path.c_str());
+        if (sock < 0 || bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 64) < 0) {
+            cerr << "serve: can't listen on " << path << ": " << strerror(errno) << endl;
+            return 1;
         }
 
-        return func;
-    }
+        // no SA_RESTART, so a signal breaks poll() and we shut down
+        struct sigaction act;
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = [](int) { stopping = 1; };
+        sigaction(SIGINT, &act, nullptr);
+        sigaction(SIGTERM, &act, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+
+        cerr << "serve: listening on " << path << endl;
+        vector<unique_ptr<conn_t>> conns;
+        vector<pollfd> fds;
+        while (!stopping) {
+
+            // a request waits on input until it has its id or its run is
+            // suspended, and on output while some is left; a suspended
+            // run for idle_timeout seconds at most
+            fds.assign(1, pollfd{sock, POLLIN, 0});
+            auto now = chrono::steady_clock::now();
+            auto idle_for = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(idle_timeout));
+            int wait_ms = -1;
+            for (auto &conn : conns) {
+                short events = conn->out_buf.empty() ? 0 : POLLOUT;
+                if (!conn->have_id || conn->status == engine_t::SUSPENDED)
+                    events |= POLLIN;
+                if (conn->status == engine_t::SUSPENDED && idle_timeout > 0) {
+                    auto left = chrono::duration_cast<chrono::milliseconds>(conn->suspended + idle_for - now).count() + 1;
+                    wait_ms = wait_ms < 0 ? max<int>(left, 0) : min<int>(wait_ms, max<int>(left, 0));
+                }
+                fds.push_back(pollfd{conn->fd, events, 0});
+            }
+            if (poll(fds.data(), fds.size(), wait_ms) < 0) {
+                if (errno != EINTR)
+                    cerr << "serve: poll failed: " << strerror(errno) << endl;
+                continue;
+            }
 
-    bool run_once(tokenizer_t &tok, map<string, lmb_hdr_t> &env) {
+            now = chrono::steady_clock::now();
+            for (size_t i = 0; i < conns.size(); i++) {
+                conn_t &conn = *conns[i];
+                short revents = fds[i + 1].revents;
+                if (revents & POLLOUT)
+                    conn.flush();
+                if (revents & (POLLIN | POLLHUP | POLLERR))
+                    step(conn);
+                else if (conn.status == engine_t::SUSPENDED && idle_timeout > 0 && now - conn.suspended >= idle_for)
+                    step(conn);
+            }
 
-        if (tok.peak() == "")
-            return false;
+            if (fds[0].revents & POLLIN) {
+                int fd;
+                while ((fd = accept4(sock, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                    conns.emplace_back(new conn_t(fd));
+                    step(*conns.back());
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    cerr << "serve: accept failed: " << strerror(errno) << endl;
+            }
 
-        map<string, size_t> ref;
-        auto prog = parse_single_expr(tok, ref);
-
-        lmb_hdr_t arg = nullptr;
-        env_t nenv(ref.empty() ? 0 : ref.size() - 1);
-        for (auto pair : ref) {
-            if (!env.count(pair.first)) {
-                std::cerr << "Unknown ident: " << pair.first << std::endl;
-                return false;
-            } else if (pair.second > 0) {
-                nenv[pair.second-1] = env[pair.first];
-            } else {
-                arg = env[pair.first];
+            size_t kept = 0;
+            for (auto &conn : conns) {
+                if (!conn->over()) {
+                    conns[kept++] = move(conn);
+                    continue;
+                }
+                finish(*conn);
             }
+            conns.resize(kept);
         }
 
-        prog->eval(shadow_env_t{arg, nenv});
-        return true;
+        // runs still waiting on input see its end, and finish
+        for (auto &conn : conns) {
+            conn->in_eof = true;
+            if (!conn->have_id)
+                step(*conn);
+            while (conn->engine != nullptr)
+                step(*conn);
+            finish(*conn);
+        }
+        conns.clear();
+
+        close(sock);
+        unlink(path.c_str());
+        for (auto &ent : latency)
+            ent.second.print(cerr, "serve: " + ent.first);
+        return 0;
     }
 };
+volatile sig_atomic_t serve_t::stopping = 0;
 
 // }}}
 
-// runtime {{{
-
-void output(int bit) {
+// main {{{
 
-    static int pos = 7;
-    static int val = 0;
+int main(int argc, char *args[]) {
 
-    val |= (bit << pos--);
-    if (pos < 0) {
-        cout << char(val);
-        cout.flush();
-        pos = 7, val = 0;
+    const char *path = nullptr;
+    const char *memo_path = nullptr;
+    const char *snapshot_path = nullptr;
+    const char *restore_path = nullptr;
+    const char *policy_path = nullptr;
+    size_t snapshot_after = size_t(-1);
+    size_t memo_min_steps = 256;
+    vector<string> inputs;
+    string serve_path;
+    bool stats = false;
+    bool hash_stats = false;
+    bool gc = false;
+    size_t gc_threshold = 0;
+    bool lazy = false;
+    bool curried = false;
+    size_t heap_report = 0;
+    size_t max_steps = 0, max_heap_mb = 0;
+    double timeout = 0, idle_timeout = 0;
+    const char *metrics_path = nullptr;
+    double metrics_interval = 0;
+
+    for (int i = 1; i < argc; i++) {
+        string opt = args[i];
+        if (opt == "--stats")
+            stats = true;
+        else if (opt == "--hash-stats")
+            hash_stats = true;
+        else if (opt == "--gc")
+            gc = true;
+        else if (opt == "--lazy")
+            lazy = true;
+        else if (opt == "--curried")
+            curried = true;
+        else if (opt == "--heap-report")
+            heap_report = 20;
+        else if (opt.compare(0, 14, "--heap-report=") == 0)
+            heap_report = stoul(opt.substr(14));
+        else if (opt.compare(0, 12, "--max-steps=") == 0)
+            max_steps = stoul(opt.substr(12));
+        else if (opt.compare(0, 14, "--max-heap-mb=") == 0)
+            max_heap_mb = stoul(opt.substr(14));
+        else if (opt.compare(0, 10, "--timeout=") == 0)
+            timeout = stod(opt.substr(10));
+        else if (opt.compare(0, 15, "--idle-timeout=") == 0)
+            idle_timeout = stod(opt.substr(15));
+        else if (opt.compare(0, 10, "--metrics=") == 0)
+            metrics_path = args[i] + 10;
+        else if (opt.compare(0, 19, "--metrics-interval=") == 0)
+            metrics_interval = stod(opt.substr(19));
+        else if (opt.compare(0, 15, "--gc-threshold=") == 0)
+            gc = true, gc_threshold = stoul(opt.substr(15));
+        else if (opt.compare(0, 12, "--memo-file=") == 0)
+            memo_path = args[i] + 12;
+        else if (opt.compare(0, 17, "--memo-min-steps=") == 0)
+            memo_min_steps = stoul(opt.substr(17));
+        else if (opt.compare(0, 14, "--memo-policy=") == 0)
+            policy_path = args[i] + 14;
+        else if (opt.compare(0, 11, "--snapshot=") == 0)
+            snapshot_path = args[i] + 11;
+        else if (opt.compare(0, 17, "--snapshot-after=") == 0)
+            snapshot_after = stoul(opt.substr(17));
+        else if (opt.compare(0, 10, "--restore=") == 0)
+            restore_path = args[i] + 10;
+        else if (opt.compare(0, 8, "--batch=") == 0)
+            batch_t::out_dir = opt.substr(8);
+        else if (opt.compare(0, 7, "--jobs=") == 0)
+            batch_t::jobs = stoul(opt.substr(7));
+        else if (opt.compare(0, 8, "--serve=") == 0)
+            serve_path = opt.substr(8);
+        else if (path == nullptr)
+            path = args[i];
+        else
+            inputs.push_back(opt);
     }
-}
-
-int input() {
 
-    static int pos = -1;
-    static int val = 0;
-
-    if (pos < 0) {
-        val = cin.get();
-        if (val == EOF)
-            return EOF;
-        pos = 7;
+    assert(path != nullptr || restore_path != nullptr);
+    assert(inputs.empty() || !batch_t::out_dir.empty() || !serve_path.empty());
+    if (lazy && (memo_path != nullptr || snapshot_path != nullptr || restore_path != nullptr)) {
+        cerr << "--lazy can't be used with --memo-file, --snapshot or --restore" << endl;
+        return 1;
     }
 
-    return (val >> pos--) & 1;
-}
+    // appended to, so workers of a batch and successive runs share a file
+    ofstream metrics_file;
+    if (metrics_path != nullptr) {
+        metrics_file.open(metrics_path, ios::app);
+        if (!metrics_file) {
+            cerr << "can't open " << metrics_path << endl;
+            return 1;
+        }
+    }
+    ostream &metrics = metrics_path != nullptr ? metrics_file : cerr;
+    // SIGUSR1 lines go to stderr without either
+    bool want_metrics = metrics_path != nullptr || metrics_interval > 0;
+
+    // never destroyed: releasing the heap closure by closure takes longer
+    // than the run itself on big programs, and exit frees it anyway
+    auto load = [&](const char *path) -> engine_t* {
+        engine_t *engine = new engine_t();
+        if (gc)
+            engine->gc(gc_threshold);
+        if (lazy)
+            engine->lazy();
+        if (curried)
+            engine->curried();
+        engine->limits(max_steps, max_heap_mb, timeout, idle_timeout);
+        if (heap_report)
+            engine->heap_report_on_request(cerr, heap_report);
+        if (want_metrics)
+            engine->metrics(metrics, metrics_interval);
+        if (memo_path != nullptr && !engine->open_memo_file(memo_path, memo_min_steps))
+            return nullptr;
+        if (policy_path != nullptr && !engine->read_memo_policy(policy_path))
+            return nullptr;
+        if (restore_path != nullptr && !engine->restore(restore_path))
+            return nullptr;
+        if (snapshot_path != nullptr)
+            engine->snapshot(snapshot_path, snapshot_after);
+        if (path != nullptr) {
+            fstream fin(path);
+            engine->load(fin);
+        }
+        return engine;
+    };
 
+    auto done = [&](engine_t &engine) {
+        if (stats)
+            engine.print_stats(cerr);
+        engine.close_memo_file();
+        if (policy_path != nullptr)
+            engine.write_memo_policy(policy_path);
+        if (hash_stats)
+            engine.print_hash_stats(cerr);
+        if (heap_report)
+            engine.print_heap_report(cerr, heap_report);
+    };
 
-struct builtin_p0_expr_t : public cached_expr_t<builtin_p0_expr_t> {
-    virtual const lmb_hdr_t& eval(const shadow_env_t &env) const {
-        output(0);
-        return env[0];
+    // the report of the top heap_report lambda bodies at exit, and on
+    // SIGUSR2 while running
+    if (heap_report) {
+        struct sigaction act;
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = [](int) { engine_t::request_heap_report(); };
+        act.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &act, nullptr);
     }
-};
 
-struct builtin_p1_expr_t : public cached_expr_t<builtin_p1_expr_t> {
-    virtual const lmb_hdr_t& eval(const shadow_env_t &env) const {
-        output(1);
-        return env[0];
+    // a metrics line on SIGUSR1 while running, see engine_t::request_metrics
+    {
+        struct sigaction act;
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = [](int) { engine_t::request_metrics(); };
+        act.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &act, nullptr);
     }
-};
 
-struct builtin_g_expr_t : public cached_expr_t<builtin_g_expr_t> {
-    virtual const lmb_hdr_t& eval(const shadow_env_t &env) const {
-        int bit = input();
-        return bit == EOF ? env[3] : env[bit+1];
+    if (!serve_path.empty()) {
+        // every argument is a program here
+        if (path != nullptr)
+            inputs.insert(inputs.begin(), path);
+        serve_t serve;
+        serve.load = load;
+        serve.idle_timeout = idle_timeout;
+        for (auto &prog : inputs)
+            if (!serve.add(prog))
+                return 1;
+        int retv = serve.run(serve_path);
+        for (auto &ent : serve.engines)
+            for (auto engine : ent.second)
+                done(*engine);
+        return retv;
     }
-};
 
-// }}}
+    engine_t *engine = load(path);
+    if (engine == nullptr)
+        return 1;
 
-// main {{{
-
-int main(int argc, char *args[]) {
+    if (!batch_t::out_dir.empty())
+        return batch_t::run(*engine, inputs, [&]() { done(*engine); });
 
-    assert(argc > 1);
-    fstream fin(args[1]);
-
-    tokenizer_t toks(fin);
-    parser_t parser;
-
-    map<string, lmb_hdr_t> env;
-    env["__builtin_p0"] = make_lmb(builtin_p0_expr_t::create(), env_t{});
-    env["__builtin_p1"] = make_lmb(builtin_p1_expr_t::create(), env_t{});
-    env["__builtin_g"] = make_lmb(
-        lmb_expr_t::create(
-           lmb_expr_t::create(
-               lmb_expr_t::create(
-                    builtin_g_expr_t::create(),
-                    arg_map_t{1, 2, 0}),
-                arg_map_t{1, 0}),
-            arg_map_t{0}),
-        env_t{}
-    );
-
-    while (parser.run_once(toks, env));
+    // what was done so far is reported either way
+    auto status = engine->run();
+    if (status != engine_t::DONE) {
+        cerr << "lmb: aborted, " << abort_reason(status) << endl;
+        if (!stats)
+            engine->print_stats(cerr);
+    }
+    done(*engine);
+    return status == engine_t::DONE ? 0 : 1 + int(status);
 }
 
 // }}}
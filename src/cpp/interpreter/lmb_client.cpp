@@ -0,0 +1,146 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+// Runs one request against `lmb --serve`: stdin is the input, the output
+// goes to stdout. Input is sent while output is read, so a program that
+// answers line by line isn't stuck behind a full socket buffer. Exits as
+// lmb would have: 0 once the run is done, 1 + its status if it was stopped
+// at a limit, and 1 on errors or a reply cut short.
+//
+//   lmb_client [--time] SOCK ID < in > out
+
+int main(int argc, char *args[]) {
+
+    bool timing = false;
+    const char *path = nullptr, *id = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (string(args[i]) == "--time")
+            timing = true;
+        else if (path == nullptr)
+            path = args[i];
+        else
+            id = args[i];
+    }
+    if (path == nullptr || id == nullptr) {
+        cerr << "usage: lmb_client [--time] SOCK ID < in > out" << endl;
+        return 2;
+    }
+
+    auto start = chrono::steady_clock::now();
+    auto since = [&]() { return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(); };
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        cerr << "lmb_client: can't connect to " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    string pending = string(id) + "\n", header;
+    bool in_open = true, shut = false, header_done = false;
+    // after the header, 0xff escapes the next byte: another 0xff, or the
+    // status the reply ends with
+    bool escaped = false;
+    int status = -1;
+    double first_byte = -1;
+    char buf[4096];
+
+    for (;;) {
+
+        pollfd fds[2] = {{sock, POLLIN, 0}, {STDIN_FILENO, 0, 0}};
+        if (!pending.empty())
+            fds[0].events |= POLLOUT;
+        else if (in_open)
+            fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLOUT) {
+            ssize_t put = write(sock, pending.data(), pending.size());
+            if (put > 0)
+                pending.erase(0, put);
+            else if (errno != EAGAIN)
+                pending.clear(), in_open = false;
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            ssize_t got = read(STDIN_FILENO, buf, sizeof(buf));
+            if (got > 0)
+                pending.append(buf, got);
+            else
+                in_open = false;
+        }
+        // the server sees EOF once everything is sent
+        if (!in_open && pending.empty() && !shut) {
+            shutdown(sock, SHUT_WR);
+            shut = true;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t got = read(sock, buf, sizeof(buf));
+            if (got < 0 && errno == EAGAIN)
+                continue;
+            if (got <= 0)
+                break;
+            if (first_byte < 0)
+                first_byte = since();
+            size_t off = 0;
+            while (!header_done && off < size_t(got)) {
+                char chr = buf[off++];
+                if (chr == '\n')
+                    header_done = true;
+                else
+                    header += chr;
+            }
+            if (header_done && header != "ok") {
+                cerr << "lmb_client: " << header << endl;
+                return 1;
+            }
+            size_t len = 0;
+            for (; off < size_t(got) && status < 0; off++) {
+                unsigned char chr = buf[off];
+                if (escaped && chr != 0xff)
+                    status = chr - '0';
+                else if (!escaped && chr == 0xff)
+                    escaped = true;
+                else {
+                    buf[len++] = chr;
+                    escaped = false;
+                }
+            }
+            if (len > 0 && write(STDOUT_FILENO, buf, len) < 0)
+                return 1;
+        }
+    }
+
+    if (timing)
+        cerr << "lmb_client: first byte " << first_byte << " ms, total " << since() << " ms" << endl;
+    if (status < 0) {
+        cerr << "lmb_client: reply cut short" << endl;
+        return 1;
+    }
+    // as engine_t::status_t goes
+    static const char *reasons[] = {"done", "out of steps", "out of memory", "out of time", "out of stack"};
+    if (status > 0)
+        cerr << "lmb_client: aborted, " << (status < 5 ? reasons[status] : "unknown status") << endl;
+    return status == 0 ? 0 : 1 + status;
+}
@@ -7,36 +7,118 @@
 #include <tuple>
 #include <memory>
 #include <iostream>
+#include <cstdint>
 
 using namespace std;
 
 struct lmb_t;
+
+#ifdef LMB_SHARED_PTR
+
 using lmb_hdr_t = shared_ptr<const lmb_t>;
 
+template <typename T, typename... Args>
+inline lmb_hdr_t new_lmb(Args&&... args) {
+    return make_shared<T>(std::forward<Args>(args)...);
+}
+
+#else
+
+// A counted reference to a closure. Programs are single threaded, so the
+// count is a plain one in the closure itself, where shared_ptr would keep
+// an atomic one in a block of its own; define LMB_SHARED_PTR for that.
+template <typename T>
+struct lmb_ref_t {
+
+    T *ptr;
+
+    lmb_ref_t() : ptr(nullptr) {}
+    lmb_ref_t(std::nullptr_t) : ptr(nullptr) {}
+    explicit lmb_ref_t(T *_ptr) : ptr(_ptr) { if (ptr) ++ptr->refs; }
+    lmb_ref_t(const lmb_ref_t &ref) : ptr(ref.ptr) { if (ptr) ++ptr->refs; }
+    lmb_ref_t(lmb_ref_t &&ref) : ptr(ref.ptr) { ref.ptr = nullptr; }
+    ~lmb_ref_t() { if (ptr && --ptr->refs == 0) delete ptr; }
+
+    lmb_ref_t& operator=(lmb_ref_t ref) {
+        std::swap(ptr, ref.ptr);
+        return *this;
+    }
+
+    T* get() const { return ptr; }
+    T* operator->() const { return ptr; }
+    T& operator*() const { return *ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+    bool operator==(const lmb_ref_t &ref) const { return ptr == ref.ptr; }
+    bool operator!=(const lmb_ref_t &ref) const { return ptr != ref.ptr; }
+    bool operator<(const lmb_ref_t &ref) const { return less<T*>()(ptr, ref.ptr); }
+};
+
+namespace std {
+template <typename T>
+struct hash<lmb_ref_t<T>> {
+    size_t operator()(const lmb_ref_t<T> &ref) const { return hash<T*>()(ref.ptr); }
+};
+}
+
+using lmb_hdr_t = lmb_ref_t<const lmb_t>;
+
+template <typename T, typename... Args>
+inline lmb_hdr_t new_lmb(Args&&... args) {
+    return lmb_hdr_t(new T(std::forward<Args>(args)...));
+}
+
+#endif
+
 template <int n>
 using env_t = array<lmb_hdr_t, n>;
 
+// the closure of T over args, the same one every time
 template <typename T, typename... Args>
-inline shared_ptr<T> make_lmb(Args&&... args) {
+inline lmb_hdr_t make_lmb(Args&&... args) {
 
-    static map<tuple<Args...>, shared_ptr<T>> cache;
+    static map<tuple<Args...>, lmb_hdr_t> cache;
 
     auto key = make_tuple(args...);
     auto it = cache.find(key);
     if (it != cache.end())
         return it->second;
     else
-        return cache[key] = make_shared<T>(std::forward<Args>(args)...);
+        return cache[key] = new_lmb<T>(std::forward<Args>(args)...);
 }
 
-struct lmb_t {
-
+// a template so the definition can live in the header, shared by every
+// translation unit of a sharded program
+template <typename T = void>
+struct lmb_state_t {
     static bool pure;
+};
+template <typename T>
+bool lmb_state_t<T>::pure = true;
+
+struct lmb_t : lmb_state_t<> {
 
     mutable unordered_map<lmb_hdr_t, lmb_hdr_t> cache;
+    // see lmb_ref_t
+    mutable size_t refs = 0;
+
+    // set by code from lmb_c --lazy: whether the closure surely applies its
+    // argument, and whether a builtin is reachable from it; anything else
+    // is taken as both
+    bool strict = true;
+    bool effects = true;
+    bool thunk = false;
+    // set by code from lmb_c --memo-policy: whether results are kept in
+    // cache, off where the interpreter found it pays less than it costs
+    bool memo = true;
+    // a byte as __builtin_getbyte makes them, see __builtin_putbyte
+    bool byte = false;
 
     lmb_hdr_t cached_exec(const lmb_hdr_t &arg) const {
 
+        if (!memo)
+            return exec(arg);
+
         auto it = cache.find(arg);
         if (it != cache.end())
             return it->second;
@@ -54,12 +136,103 @@ struct lmb_t {
         }
     }
 
+    // this applied to a, then the result to b; lmb_c's code for closures
+    // taking two arguments does it without the closure in between
+    virtual lmb_hdr_t cached_exec2(const lmb_hdr_t &a, const lmb_hdr_t &b) const {
+        return cached_exec(a)->cached_exec(b);
+    }
+
     virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const = 0;
     virtual ~lmb_t() {}
 };
-bool lmb_t::pure = true;
 
-static inline void output(int bit) {
+// the interpreter's key combiner: a 64 bit finalizer (murmur3 / splitmix
+// style) over both, so every bit of either affects every bit of the hash
+inline size_t _combine(size_t a, size_t b) {
+    uint64_t x = a * 0x9e3779b97f4a7c15ULL + b;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    x ^= x >> 32;
+    return x;
+}
+
+// Memo of the cached_exec2 of a closure, keyed on both arguments, pure
+// results only as in cached_exec.
+struct calls_t {
+
+    using args_t = pair<lmb_hdr_t, lmb_hdr_t>;
+    struct hash_t {
+        size_t operator()(const args_t &args) const {
+            return _combine(hash<lmb_hdr_t>()(args.first), hash<lmb_hdr_t>()(args.second));
+        }
+    };
+    unordered_map<args_t, lmb_hdr_t, hash_t> cache;
+
+    template <typename F>
+    lmb_hdr_t operator()(const lmb_hdr_t &a, const lmb_hdr_t &b, F exec) {
+
+        args_t key(a, b);
+        auto it = cache.find(key);
+        if (it != cache.end())
+            return it->second;
+
+        bool _pure = lmb_t::pure;
+        lmb_t::pure = true;
+        auto retv = exec();
+
+        if (lmb_t::pure) {
+            lmb_t::pure = _pure;
+            return cache[key] = retv;
+        } else {
+            lmb_t::pure = false;
+            return retv;
+        }
+    }
+};
+
+// An argument put off by lmb_c --lazy, computed the first time it's
+// applied. Only made of what can't reach a builtin, so when doesn't matter.
+struct thunk_t : public lmb_t {
+
+    mutable lmb_hdr_t val;
+
+    thunk_t() { effects = false; thunk = true; }
+
+    const lmb_hdr_t& force() const {
+        if (!val)
+            val = compute();
+        return val;
+    }
+
+    virtual lmb_hdr_t compute() const = 0;
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        return force()->cached_exec(arg);
+    }
+};
+
+// the value behind lmb, where its identity matters
+inline lmb_hdr_t force(lmb_hdr_t lmb) {
+    while (lmb->thunk)
+        lmb = static_cast<const thunk_t&>(*lmb).force();
+    return lmb;
+}
+
+// what a thunk captures: the value if there is one already
+inline const lmb_hdr_t& settled(const lmb_hdr_t &lmb) {
+    return lmb->thunk && static_cast<const thunk_t&>(*lmb).val ? static_cast<const thunk_t&>(*lmb).val : lmb;
+}
+
+template <size_t n>
+inline bool reaches(const array<lmb_hdr_t, n> &env) {
+    for (auto &lmb : env)
+        if (lmb->effects)
+            return true;
+    return false;
+}
+
+inline void output(int bit) {
 
     static int pos = 7;
     static int val = 0;
@@ -74,9 +247,7 @@ static inline void output(int bit) {
     lmb_t::pure = false;
 }
 
-static inline int input() {
-
-    // FIXME: how about eof?
+inline int input_bit() {
 
     static int pos = EOF;
     static int val = 0;
@@ -84,7 +255,7 @@ static inline int input() {
     if (pos < 0) {
         val = cin.get();
         if (val == EOF)
-            return 1;
+            return EOF;
         pos = 7;
     }
 
@@ -92,6 +263,14 @@ static inline int input() {
     return (val >> pos--) & 1;
 }
 
+inline int input() {
+
+    // FIXME: how about eof?
+
+    int bit = input_bit();
+    return bit == EOF ? 1 : bit;
+}
+
 struct __builtin_p0_t : public lmb_t {
     virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
         output(0);
@@ -132,4 +311,114 @@ static lmb_hdr_t __builtin_g = make_lmb<__builtin_g0_t>();
 static lmb_hdr_t __builtin_p0 = make_lmb<__builtin_p0_t>();
 static lmb_hdr_t __builtin_p1 = make_lmb<__builtin_p1_t>();
 
+// A byte is \f f b7 .. b0 over Church booleans (\t \f t is 1), so one
+// application reads or writes what takes eight of __builtin_g/p0/p1:
+//
+//   __builtin_getbyte eof w    the next byte, or eof at the end of input
+//   __builtin_putbyte byte w   puts byte out (anything else is ignored), w
+
+struct __builtin_const_t : public lmb_t {
+    env_t<1> env;
+    __builtin_const_t(const env_t<1> &_env) : env(_env) {}
+    virtual lmb_hdr_t exec(const lmb_hdr_t &) const {
+        return env[0];
+    }
+};
+
+struct __builtin_id_t : public lmb_t {
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        return arg;
+    }
+};
+
+struct __builtin_true_t : public lmb_t {
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        return make_lmb<__builtin_const_t>(env_t<1>{{arg}});
+    }
+};
+
+struct __builtin_false_t : public lmb_t {
+    virtual lmb_hdr_t exec(const lmb_hdr_t &) const {
+        return make_lmb<__builtin_id_t>();
+    }
+};
+
+static lmb_hdr_t __builtin_true = make_lmb<__builtin_true_t>();
+static lmb_hdr_t __builtin_false = make_lmb<__builtin_false_t>();
+
+struct __builtin_byte_t : public lmb_t {
+    env_t<8> env;
+    __builtin_byte_t(const env_t<8> &_env) : env(_env) { byte = true; }
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        lmb_hdr_t retv = arg;
+        for (auto &bit : env)
+            retv = retv->cached_exec(bit);
+        return retv;
+    }
+};
+
+// \b7 .. \b0 the byte of them, taking its n-th argument so far
+struct __builtin_mkbyte_t : public lmb_t {
+    int n;
+    env_t<8> got;
+    __builtin_mkbyte_t(int _n, const env_t<8> &_got) : n(_n), got(_got) {}
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        env_t<8> ngot = got;
+        ngot[n] = arg;
+        if (n == 7)
+            return make_lmb<__builtin_byte_t>(std::move(ngot));
+        return make_lmb<__builtin_mkbyte_t>(n + 1, std::move(ngot));
+    }
+};
+
+struct __builtin_getbyte1_t : public lmb_t {
+    env_t<1> env;
+    __builtin_getbyte1_t(const env_t<1> &_env) : env(_env) {}
+    virtual lmb_hdr_t exec(const lmb_hdr_t &) const {
+        lmb_t::pure = false;
+        int bit = input_bit();
+        if (bit == EOF)
+            return env[0];
+        env_t<8> bits;
+        for (int k = 0; k < 8; k++) {
+            bits[k] = bit ? __builtin_true : __builtin_false;
+            // a byte cut short by the end of input is padded with zeros
+            if (k < 7 && (bit = input_bit()) == EOF)
+                bit = 0;
+        }
+        return make_lmb<__builtin_byte_t>(std::move(bits));
+    }
+};
+
+struct __builtin_getbyte0_t : public lmb_t {
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        return make_lmb<__builtin_getbyte1_t>(env_t<1>{{arg}});
+    }
+};
+
+struct __builtin_putbyte1_t : public lmb_t {
+    env_t<1> env;
+    __builtin_putbyte1_t(const env_t<1> &_env) : env(_env) {}
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        // whatever the program built its byte with, applied to mkbyte it
+        // comes back as the closure getbyte would have made, as in the
+        // interpreter; anything else is left out
+        auto byte = force(env[0]->cached_exec(make_lmb<__builtin_mkbyte_t>(0, env_t<8>())));
+        if (!byte->byte)
+            return arg;
+        for (auto &bit : static_cast<const __builtin_byte_t&>(*byte).env)
+            output(force(force(bit)->cached_exec(__builtin_true)->cached_exec(__builtin_false)) == __builtin_true);
+        return arg;
+    }
+};
+
+struct __builtin_putbyte0_t : public lmb_t {
+    virtual lmb_hdr_t exec(const lmb_hdr_t &arg) const {
+        return make_lmb<__builtin_putbyte1_t>(env_t<1>{{arg}});
+    }
+};
+
+static lmb_hdr_t __builtin_getbyte = make_lmb<__builtin_getbyte0_t>();
+static lmb_hdr_t __builtin_putbyte = make_lmb<__builtin_putbyte0_t>();
+
 #endif
@@ -9,14 +9,22 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <cstdint>
 
 struct transpiler_t {
 
     std::set<std::string> builtins;
+    // put off arguments the callee may not need, see impl_t::__defer_args
+    bool lazy;
+    // fingerprints of lambda bodies whose closures don't keep results, as
+    // lmb --memo-policy writes them
+    std::set<uint64_t> unmemoized;
 
-    transpiler_t(std::set<std::string> &_builtins);
+    transpiler_t(std::set<std::string> &_builtins, bool _lazy=false, const std::set<uint64_t> &_unmemoized={});
 
     void transpile(node_hdr_t node, std::ostream &stm);
+    // split over shards next to path, see impl_t
+    void transpile(node_hdr_t node, const std::string &path, int shards);
 
 private:
     struct impl_t;
@@ -1,9 +1,12 @@
 #include "transpiler.hpp"
 #include <sstream>
+#include <fstream>
 #include <iostream>
 #include <stack>
 #include <tuple>
 #include <cassert>
+#include <algorithm>
+#include <cctype>
 
 struct code_lmb_t;
 
@@ -14,6 +17,8 @@ struct code_id_t {
         LOCAL,
         ENV,
         ARG,
+        // the second argument of cached_exec2, see __uncurry
+        ARG2,
         GLOBAL,
     };
 
@@ -37,6 +42,8 @@ struct code_id_t {
                 return stm << "_e[" << id.val << "]";
             case code_id_t::ARG:
                 return stm << "_a";
+            case code_id_t::ARG2:
+                return stm << "_b";
             default:
                 assert(false);
 
@@ -46,9 +53,14 @@ struct code_id_t {
 
 struct code_inst_t {
 
+    // DEFER computes retv, the argument of an application of func, by lmb
+    // (a thunk over envs) if func may drop it, see __defer_args; APPLY2
+    // applies func to arg then to arg2 in one call, see __uncurry
     enum type_t {
         APPLY,
         LAMBDA,
+        DEFER,
+        APPLY2,
     };
 
     type_t type;
@@ -57,6 +69,8 @@ struct code_inst_t {
     code_id_t arg;
     std::shared_ptr<code_lmb_t> lmb;
     std::vector<code_id_t> envs;
+    bool hoisted;
+    code_id_t arg2;
 };
 
 struct code_block_t {
@@ -71,6 +85,8 @@ struct code_lmb_t {
     int env_cnt;
     code_block_t body;
     int next_local_id;
+    // its closures don't keep results, see transpiler_t::unmemoized
+    bool unmemoized;
 };
 
 struct transpiler_t::impl_t {
@@ -79,7 +95,17 @@ struct transpiler_t::impl_t {
     std::map<std::string, code_id_t> builtins;
     std::set<code_id_t> builtin_ids;
 
-    impl_t(transpiler_t *parent) : global_id(0) {
+    // see __defer_args
+    bool lazy;
+    std::set<std::shared_ptr<code_lmb_t>> thunks;
+    std::map<std::shared_ptr<code_lmb_t>, bool> lmb_effects;
+    std::map<std::shared_ptr<code_lmb_t>, bool> lmb_strict;
+
+    // see __body_fp
+    std::set<uint64_t> unmemoized;
+    std::map<const node_t*, uint64_t> body_fps;
+
+    impl_t(transpiler_t *parent) : global_id(0), lazy(parent->lazy), unmemoized(parent->unmemoized) {
         for (auto str : parent->builtins)
             builtins.insert(std::make_pair(str, next_global_id()));
         for (auto pair : builtins)
@@ -106,7 +132,7 @@ struct transpiler_t::impl_t {
         return code_id_t{code_id_t::ENV, val};
     }
 
-    void transpile(node_hdr_t node, std::ostream &stm) {
+    std::shared_ptr<code_lmb_t> __compile(node_hdr_t node) {
 
         global_id = builtins.size();
         std::map<std::string, int> ident_cnt;
@@ -118,103 +144,495 @@ struct transpiler_t::impl_t {
         code_id_t retv = local_id(0);
         int next_local_id = 1;
         int next_env_id = 0;
+        if (!unmemoized.empty()) {
+            std::map<std::string, size_t> ref;
+            __body_fp(node, ref);
+        }
         __transpile(node, next_local_id, next_env_id, retv, insts, envs, deps, ident_cnt);
 
         code_block_t block{retv, insts, deps};
-        std::shared_ptr<code_lmb_t> prog(new code_lmb_t{name, 0, block, next_local_id});
+        std::shared_ptr<code_lmb_t> prog(new code_lmb_t{name, 0, block, next_local_id, false});
 
         // optimize
         __inline_temp_lmb(prog);
         __extract_static_lmb(prog); // this assumes that all temp lmb are inlined
         __dedup_lmb(prog);
+        __hoist_invariant_lmb(prog); // this assumes that lmbs are deduped
+        if (lazy)
+            __defer_args(prog);
+        __uncurry(prog);
 
-        // output
-        __emit(prog, stm);
+        return prog;
     }
 
-    void __emit(std::shared_ptr<code_lmb_t> lmb, std::ostream &stm) {
+    void transpile(node_hdr_t node, std::ostream &stm) {
+
+        auto prog = __compile(node);
 
+        // output
         stm << "#include \"runtime.hpp\"\n";
         for (auto pair : builtins)
             stm << "auto& " << pair.second << " = " << pair.first << ";\n";
 
+        std::vector<std::shared_ptr<code_lmb_t>> order;
         std::set<std::shared_ptr<code_lmb_t>> emited;
-        __emit(lmb, stm, emited);
+        __order(prog, order, emited);
+        for (auto lmb : order)
+            __emit(lmb, false, stm, stm);
 
-        stm << "int main() {\n"
-            << "  " << lmb->name << "->cached_exec(__builtin_g);\n"
-            << "}\n";
+        __emit_main(prog, stm);
     }
 
-    void __emit(std::shared_ptr<code_lmb_t> lmb, std::ostream &stm, std::set<std::shared_ptr<code_lmb_t>> &emited) {
+    // Same program as shards path.K.cpp, plus main in path itself. Structs
+    // are named after a hash of their own code, the structs it makes or
+    // refers to left out, and each file declares only those its code
+    // refers to. An edit renames the lambdas it changes, which changes the
+    // code of those referring to them but not their names, and files are
+    // only rewritten when their content changes: make recompiles the
+    // shards these lambdas go to (by name) and those declaring them.
+    void transpile(node_hdr_t node, const std::string &path, int shards) {
+
+        auto prog = __compile(node);
+
+        std::string base = path;
+        if (base.size() > 4 && base.compare(base.size() - 4, 4, ".cpp") == 0)
+            base.resize(base.size() - 4);
+
+        std::ostringstream prelude;
+        prelude << "#include \"runtime.hpp\"\n";
+        std::map<int, std::string> names;
+        for (auto pair : builtins) {
+            prelude << "static auto& " << pair.second << " = " << pair.first << ";\n";
+            std::ostringstream name;
+            name << pair.second;
+            names[pair.second.val] = name.str();
+        }
 
-        if (emited.count(lmb))
-            return;
-        emited.insert(lmb);
+        std::vector<std::shared_ptr<code_lmb_t>> order;
+        std::set<std::shared_ptr<code_lmb_t>> emited;
+        __order(prog, order, emited);
 
-        for (auto dep : lmb->body.deps)
-            __emit(dep, stm, emited);
+        std::map<int, std::string> masked(names);
+        for (auto lmb : order)
+            masked[lmb->name.val] = "_ref";
 
-        bool need_arg = false;
-        if (lmb->body.retv == arg_id())
-            need_arg = true;
-        else
-            for (auto &inst : lmb->body.insts)
-                if (inst.type == code_inst_t::APPLY) {
-                    if (inst.func == arg_id() || inst.arg == arg_id()) {
-                        need_arg = true;
-                        break;
-                    }
-                } else {
-                    for (auto env : inst.envs)
-                        if (env == arg_id()) {
-                            need_arg = true;
-                            break;
-                        }
-                }
+        struct part_t {
+            std::string decl, impl;
+            std::set<int> refs;
+        };
+        std::vector<part_t> code(order.size());
+        std::set<std::string> taken;
+        for (size_t i = 0; i < order.size(); i++) {
+            std::ostringstream decl, impl;
+            __emit(order[i], true, decl, impl);
+            code[i].decl = decl.str();
+            code[i].impl = impl.str();
+            // the same code twice gets the next hash, in order
+            uint64_t hash = __fnv1a(__rename(code[i].decl + code[i].impl, masked, nullptr));
+            std::string name;
+            do {
+                std::ostringstream hex;
+                hex << "_h" << std::hex << hash++;
+                name = hex.str();
+            } while (!taken.insert(name).second);
+            names[order[i]->name.val] = name;
+        }
 
-        stm << "struct " << lmb->name << "_t : public lmb_t {\n";
+        std::map<std::string, part_t> parts;
+        for (size_t i = 0; i < order.size(); i++) {
+            part_t &part = parts[names[order[i]->name.val]];
+            part.decl = __rename(code[i].decl, names, nullptr);
+            part.impl = __rename(code[i].impl, names, &part.refs);
+        }
 
-        // member
-        if (lmb->env_cnt > 0) {
-            stm << "  env_t<" << lmb->env_cnt << "> _e;\n"; // FIXME: env name
-            stm << "  " << lmb->name << "_t(const env_t<" << lmb->env_cnt << "> &__e) : _e(__e) {}\n";
+        // what code refers to, declared, in the order of the names
+        auto declare = [&](const std::set<int> &refs, std::ostream &stm) {
+            std::set<std::string> used;
+            for (auto ref : refs)
+                if (parts.count(names[ref]))
+                    used.insert(names[ref]);
+            for (auto &name : used)
+                stm << parts[name].decl;
+        };
+
+        std::vector<std::set<int>> refs(shards);
+        std::vector<std::ostringstream> impls(shards);
+        for (auto &ent : parts) {
+            int k = __fnv1a(ent.first) % shards;
+            refs[k].insert(ent.second.refs.begin(), ent.second.refs.end());
+            impls[k] << ent.second.impl;
+        }
+        for (int k = 0; k < shards; k++) {
+            std::ostringstream shard;
+            shard << prelude.str();
+            declare(refs[k], shard);
+            shard << impls[k].str();
+            __write_if_changed(base + "." + std::to_string(k) + ".cpp", shard.str());
         }
 
-        // exec func
-        stm << "  virtual lmb_hdr_t exec(const lmb_hdr_t &";
-        if (need_arg) 
-            stm << arg_id();
-        stm << ") const {\n";
+        std::ostringstream main, body;
+        __emit_main(prog, body);
+        std::set<int> main_refs;
+        std::string main_code = __rename(body.str(), names, &main_refs);
+        main << prelude.str();
+        declare(main_refs, main);
+        main << main_code;
+        __write_if_changed(path, main.str());
+    }
 
-        // body
-        for (auto inst : lmb->body.insts) {
-            stm << "    auto " << inst.retv << " = ";
+    // code with each _gN in names renamed, and N added to refs
+    static std::string __rename(const std::string &code, const std::map<int, std::string> &names, std::set<int> *refs) {
+        std::string out;
+        size_t pos = 0;
+        while (pos < code.size()) {
+            size_t at = code.find("_g", pos);
+            size_t end = at == std::string::npos ? code.size() : at + 2;
+            while (end < code.size() && isdigit((unsigned char)code[end]))
+                end++;
+            if (at == std::string::npos || end == at + 2 || (at > 0 && (isalnum((unsigned char)code[at - 1]) || code[at - 1] == '_'))) {
+                out.append(code, pos, end - pos);
+                pos = end;
+                continue;
+            }
+            int val = std::stoi(code.substr(at + 2, end - at - 2));
+            out.append(code, pos, at - pos);
+            auto it = names.find(val);
+            out += it != names.end() ? it->second : code.substr(at, end - at);
+            if (refs != nullptr)
+                refs->insert(val);
+            pos = end;
+        }
+        return out;
+    }
+
+    static uint64_t __fnv1a(const std::string &str) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char chr : str)
+            hash = (hash ^ chr) * 0x100000001b3ULL;
+        return hash;
+    }
+
+    static void __write_if_changed(const std::string &path, const std::string &content) {
+        std::ifstream fin(path, std::ios::binary);
+        std::stringstream old;
+        old << fin.rdbuf();
+        if (fin && old.str() == content)
+            return;
+        std::ofstream(path, std::ios::binary) << content;
+    }
+
+    // insts with ids in subst replaced, the one computing assign stored to
+    // it instead of declared
+    void __emit_insts(
+        const std::vector<code_inst_t> &insts,
+        std::ostream &stm,
+        const std::string &indent,
+        const std::map<code_id_t, code_id_t> &subst,
+        code_id_t assign
+    ) {
+
+        auto id = [&](code_id_t id) {
+            return subst.count(id) ? subst.at(id) : id;
+        };
+
+        for (auto &inst : insts) {
+
+            if (inst.type == code_inst_t::DEFER) {
+
+                // a thunk when the callee may drop it and it can't do I/O,
+                // otherwise the code it would run, right here
+                std::vector<std::string> conds;
+                if (inst.func.type != code_id_t::GLOBAL) {
+                    std::ostringstream cond;
+                    cond << "!" << id(inst.func) << "->strict";
+                    conds.push_back(cond.str());
+                }
+                for (auto env : inst.envs)
+                    if (env.type != code_id_t::GLOBAL) {
+                        std::ostringstream cond;
+                        cond << "!" << id(env) << "->effects";
+                        conds.push_back(cond.str());
+                    }
+
+                std::ostringstream make;
+                make << "make_lmb<" << inst.lmb->name << "_t>(";
+                if (!inst.envs.empty()) {
+                    make << "env_t<" << inst.envs.size() << ">{{";
+                    for (auto it = inst.envs.begin(); it != inst.envs.end(); it++)
+                        make << (it != inst.envs.begin() ? ", " : "") << "settled(" << id(*it) << ")";
+                    make << "}}";
+                }
+                make << ")";
+
+                stm << indent << "lmb_hdr_t " << inst.retv << ";\n";
+                if (conds.empty()) {
+                    stm << indent << inst.retv << " = " << make.str() << ";\n";
+                    continue;
+                }
+                stm << indent << "if (";
+                for (auto it = conds.begin(); it != conds.end(); it++)
+                    stm << (it != conds.begin() ? " && " : "") << *it;
+                stm << ") {\n";
+                stm << indent << "  " << inst.retv << " = " << make.str() << ";\n";
+                stm << indent << "} else {\n";
+                std::map<code_id_t, code_id_t> nsubst;
+                for (int i = 0; i < (int)inst.envs.size(); i++)
+                    nsubst[env_id(i)] = id(inst.envs[i]);
+                __emit_insts(inst.lmb->body.insts, stm, indent + "  ", nsubst, inst.retv);
+                stm << indent << "}\n";
+                continue;
+            }
+
+            stm << indent << (inst.retv == assign ? "" : "auto ") << inst.retv << " = ";
             if (inst.type == code_inst_t::APPLY) {
-                stm << inst.func << "->cached_exec(" << inst.arg << ");\n";
+                stm << id(inst.func) << "->cached_exec(" << id(inst.arg) << ");\n";
+            } else if (inst.type == code_inst_t::APPLY2) {
+                stm << id(inst.func) << "->cached_exec2(" << id(inst.arg) << ", " << id(inst.arg2) << ");\n";
             } else {
+                if (inst.hoisted)
+                    stm << "_c" << inst.retv.val << " ? _c" << inst.retv.val << " : (_c" << inst.retv.val << " = ";
                 stm << "make_lmb<" << inst.lmb->name << "_t>(";
                 if (inst.lmb->env_cnt > 0) {
                     stm << "env_t<" << inst.envs.size() << ">{{";
                     for (auto it = inst.envs.begin(); it != inst.envs.end(); it++) {
                         if (it != inst.envs.begin())
                             stm << ", ";
-                        stm << *it;
+                        stm << id(*it);
                     }
                     stm << "}}";
                 }
-                stm << ");\n";
+                stm << (inst.hoisted ? "));\n" : ");\n");
             }
         }
-        stm << "    return " << lmb->body.retv << ";\n";
+    }
+
+    void __emit_main(std::shared_ptr<code_lmb_t> lmb, std::ostream &stm) {
+        stm << "int main() {\n"
+            << "  " << lmb->name << "->cached_exec(__builtin_g);\n"
+            << "}\n";
+    }
+
+    // dependencies first, every struct has to be complete where it's made
+    void __order(
+        std::shared_ptr<code_lmb_t> lmb,
+        std::vector<std::shared_ptr<code_lmb_t>> &order,
+        std::set<std::shared_ptr<code_lmb_t>> &emited
+    ) {
+
+        if (emited.count(lmb))
+            return;
+        emited.insert(lmb);
+
+        for (auto dep : lmb->body.deps)
+            __order(dep, order, emited);
+        order.push_back(lmb);
+    }
+
+    // whether the body of lmb refers to its argument
+    bool __uses_arg(std::shared_ptr<code_lmb_t> lmb) {
+        if (lmb->body.retv == arg_id())
+            return true;
+        for (auto &inst : lmb->body.insts) {
+            if (inst.type != code_inst_t::LAMBDA)
+                for (auto id : {inst.func, inst.arg, inst.arg2})
+                    if (id == arg_id())
+                        return true;
+            if (inst.type == code_inst_t::LAMBDA || inst.type == code_inst_t::DEFER)
+                for (auto env : inst.envs)
+                    if (env == arg_id())
+                        return true;
+        }
+        return false;
+    }
 
-        // end
-        stm << "  };\n";
-        stm << "};\n";
+    // the struct of lmb, with its exec inline, or when split the struct
+    // into decl and exec into impl
+    void __emit(std::shared_ptr<code_lmb_t> lmb, bool split, std::ostream &decl, std::ostream &impl) {
+
+        bool need_arg = __uses_arg(lmb);
+        const code_inst_t *curried = thunks.count(lmb) ? nullptr : __curried(lmb);
+
+        bool thunk = thunks.count(lmb);
+        std::ostream &stm = decl;
+        stm << "struct " << lmb->name << "_t : public " << (thunk ? "thunk_t" : "lmb_t") << " {\n";
+
+        // member, and what lazy code checks before passing a thunk
+        std::string flags;
+        if (lazy && !thunk)
+            flags = std::string(" strict = ") + (lmb_strict[lmb] ? "true" : "false") +
+                "; effects = " + (lmb_effects[lmb] ? "true" : lmb->env_cnt > 0 ? "reaches(_e)" : "false") + "; ";
+        if (lmb->unmemoized && !thunk)
+            flags += flags.empty() ? " memo = false; " : "memo = false; ";
+        if (lmb->env_cnt > 0) {
+            stm << "  env_t<" << lmb->env_cnt << "> _e;\n"; // FIXME: env name
+            stm << "  " << lmb->name << "_t(const env_t<" << lmb->env_cnt << "> &__e) : _e(__e) {" << flags << "}\n";
+        } else if (!flags.empty())
+            stm << "  " << lmb->name << "_t() {" << flags << "}\n";
+        for (auto &inst : lmb->body.insts)
+            if (inst.hoisted)
+                stm << "  mutable lmb_hdr_t _c" << inst.retv.val << ";\n";
+        if (curried) {
+            if (!lmb->unmemoized)
+                stm << "  mutable calls_t _calls;\n";
+            if (split)
+                stm << "  virtual lmb_hdr_t cached_exec2(const lmb_hdr_t &, const lmb_hdr_t &) const;\n";
+        }
+
+        // exec func (compute for thunks), defined out of the struct when split
+        std::string method = thunk ? "compute(" : "exec(const lmb_hdr_t &";
+        if (split) {
+            stm << "  virtual lmb_hdr_t " << method << ") const;\n";
+            stm << "};\n";
+            impl << "lmb_hdr_t " << lmb->name << "_t::" << method;
+        } else
+            impl << "  virtual lmb_hdr_t " << method;
+        if (need_arg) 
+            impl << arg_id();
+        impl << ") const {\n";
+
+        // body
+        __emit_insts(lmb->body.insts, impl, "    ", {}, none_id());
+        impl << "    return " << lmb->body.retv << ";\n";
+
+        // end, with cached_exec2 in between when inline
+        if (split) {
+            impl << "}\n";
+            if (curried)
+                __emit_exec2(lmb, *curried, split, impl);
+        } else {
+            impl << "  };\n";
+            if (curried)
+                __emit_exec2(lmb, *curried, split, impl);
+            impl << "};\n";
+        }
 
         // static obj
-        if (lmb->env_cnt == 0)
-            stm << "lmb_hdr_t " << lmb->name << " = make_lmb<" << lmb->name << "_t>();\n";
+        if (lmb->env_cnt == 0 && !thunk) {
+            if (split) {
+                decl << "extern lmb_hdr_t " << lmb->name << ";\n";
+                impl << "lmb_hdr_t " << lmb->name << " = make_lmb<" << lmb->name << "_t>();\n";
+            } else
+                impl << "lmb_hdr_t " << lmb->name << " = make_lmb<" << lmb->name << "_t>();\n";
+        }
+    }
+
+    // The LAMBDA inst lmb returns right away, if it's all its body does:
+    // its closures take two arguments before doing any work.
+    const code_inst_t* __curried(std::shared_ptr<code_lmb_t> lmb) {
+        auto &body = lmb->body;
+        if (body.insts.size() == 1 && body.insts[0].type == code_inst_t::LAMBDA && body.insts[0].retv == body.retv)
+            return &body.insts[0];
+        return nullptr;
+    }
+
+    // cached_exec2 of a curried lmb: the body of the closure it would
+    // return, run with that closure's env taken from its own env and _a,
+    // and the second argument as _b, memoized on both
+    void __emit_exec2(std::shared_ptr<code_lmb_t> lmb, const code_inst_t &inner, bool split, std::ostream &impl) {
+
+        std::map<code_id_t, code_id_t> subst;
+        for (int i = 0; i < (int)inner.envs.size(); i++)
+            subst[env_id(i)] = inner.envs[i];
+        subst[arg_id()] = code_id_t{code_id_t::ARG2, 0};
+        auto id = [&](code_id_t id) {
+            return subst.count(id) ? subst.at(id) : id;
+        };
+
+        // straight through when unmemoized, where the args may go unused
+        bool memo = !lmb->unmemoized;
+        bool need_a = memo || std::count(inner.envs.begin(), inner.envs.end(), arg_id());
+        bool need_b = memo || __uses_arg(inner.lmb);
+        std::string params = std::string("(const lmb_hdr_t &") + (need_a ? "_a" : "") +
+            ", const lmb_hdr_t &" + (need_b ? "_b" : "") + ") const {\n";
+
+        std::string indent = split ? "  " : "    ";
+        if (split)
+            impl << "lmb_hdr_t " << lmb->name << "_t::cached_exec2" << params;
+        else
+            impl << "  virtual lmb_hdr_t cached_exec2" << params;
+        std::string body_indent = memo ? indent + "  " : indent;
+        if (memo)
+            impl << indent << "return _calls(_a, _b, [&]() -> lmb_hdr_t {\n";
+
+        // the closure's own members are not there
+        std::vector<code_inst_t> insts = inner.lmb->body.insts;
+        for (auto &inst : insts)
+            inst.hoisted = false;
+        __emit_insts(insts, impl, body_indent, subst, none_id());
+        impl << body_indent << "return " << id(inner.lmb->body.retv) << ";\n";
+        if (memo)
+            impl << indent << "});\n";
+        impl << (split ? "}\n" : "  }\n");
+    }
+
+    // Applications of an application, ((f a) b), become one cached_exec2,
+    // which closures of curried lmbs (see __curried) answer without making
+    // the closure (f a) and its memo table. (f a) is moved down to where b
+    // is used, so only when nothing in between may do I/O, or f surely
+    // returns a closure right away.
+    void __uncurry(std::shared_ptr<code_lmb_t> prog) {
+
+        std::vector<std::shared_ptr<code_lmb_t>> order;
+        std::set<std::shared_ptr<code_lmb_t>> emited;
+        __order(prog, order, emited);
+
+        std::map<code_id_t, std::shared_ptr<code_lmb_t>> statics;
+        for (auto lmb : order)
+            statics[lmb->name] = lmb;
+        for (auto lmb : order)
+            __uncurry(lmb, statics);
+    }
+
+    void __uncurry(std::shared_ptr<code_lmb_t> lmb, std::map<code_id_t, std::shared_ptr<code_lmb_t>> &statics) {
+
+        std::map<code_id_t, int> used;
+        for (auto &inst : lmb->body.insts) {
+            used[inst.func]++;
+            used[inst.arg]++;
+            for (auto env : inst.envs)
+                used[env]++;
+        }
+        used[lmb->body.retv]++;
+
+        auto known = [&](code_id_t id) {
+            return id.type == code_id_t::GLOBAL && !builtin_ids.count(id) && statics.count(id) &&
+                !thunks.count(statics[id]) && __curried(statics[id]);
+        };
+
+        std::vector<code_inst_t> ninsts;
+        std::vector<bool> gone;
+        std::map<code_id_t, size_t> made;
+        for (auto &inst : lmb->body.insts) {
+
+            auto it = made.find(inst.func);
+            if (inst.type == code_inst_t::APPLY && it != made.end() && used[inst.func] == 1) {
+                bool pure = true;
+                for (size_t k = it->second + 1; k < ninsts.size(); k++)
+                    pure = pure && (gone[k] || ninsts[k].type == code_inst_t::LAMBDA);
+                code_inst_t &first = ninsts[it->second];
+                if (pure || known(first.func)) {
+                    code_inst_t call = first;
+                    call.type = code_inst_t::APPLY2;
+                    call.retv = inst.retv;
+                    call.arg2 = inst.arg;
+                    gone[it->second] = true;
+                    made.erase(it);
+                    ninsts.push_back(call);
+                    gone.push_back(false);
+                    continue;
+                }
+            }
+
+            if (inst.type == code_inst_t::APPLY)
+                made[inst.retv] = ninsts.size();
+            ninsts.push_back(inst);
+            gone.push_back(false);
+        }
+
+        lmb->body.insts.clear();
+        for (size_t k = 0; k < ninsts.size(); k++)
+            if (!gone[k])
+                lmb->body.insts.push_back(ninsts[k]);
     }
 
     void __transpile(
@@ -250,7 +668,7 @@ struct transpiler_t::impl_t {
             code_id_t arg = local_id(next_local_id++);
             __transpile(node.nd_fun, next_local_id, next_env_id, func, insts, envs, deps, ident_cnt);
             __transpile(node.nd_arg, next_local_id, next_env_id, arg, insts, envs, deps, ident_cnt);
-            insts.push_back(code_inst_t{code_inst_t::APPLY, retv, func, arg, nullptr, {}});
+            insts.push_back(code_inst_t{code_inst_t::APPLY, retv, func, arg, nullptr, {}, false, none_id()});
 
             return;
         } catch (std::bad_cast e) {}
@@ -273,7 +691,8 @@ struct transpiler_t::impl_t {
             lmb_envs.erase(node.arg);
 
             code_block_t block{lmb_retv, lmb_insts, lmb_deps};
-            std::shared_ptr<code_lmb_t> lmb(new code_lmb_t{name, (int)lmb_envs.size(), block, lmb_next_local_id});
+            std::shared_ptr<code_lmb_t> lmb(new code_lmb_t{name, (int)lmb_envs.size(), block, lmb_next_local_id, false});
+            lmb->unmemoized = body_fps.count(&node) && unmemoized.count(body_fps[&node]);
             deps.insert(lmb);
 
             std::vector<code_id_t> lmb_venvs(lmb_envs.size());
@@ -282,7 +701,7 @@ struct transpiler_t::impl_t {
                     envs.insert(std::make_pair(pair.first, env_id(next_env_id++)));
                 lmb_venvs[pair.second.val] = envs[pair.first];
             }
-            insts.push_back(code_inst_t{code_inst_t::LAMBDA, retv, none_id(), none_id(), lmb, lmb_venvs});
+            insts.push_back(code_inst_t{code_inst_t::LAMBDA, retv, none_id(), none_id(), lmb, lmb_venvs, false, none_id()});
 
             return;
         } catch (std::bad_cast e) {}
@@ -290,6 +709,55 @@ struct transpiler_t::impl_t {
         assert(false);
     }
 
+    static uint64_t __fingerprint(const std::vector<uint64_t> &words) {
+        auto mix = [](uint64_t x) {
+            x ^= x >> 32;
+            x *= 0xd6e8feb86659fd93ULL;
+            x ^= x >> 32;
+            x *= 0xd6e8feb86659fd93ULL;
+            x ^= x >> 32;
+            return x;
+        };
+        uint64_t h = 0x9e3779b97f4a7c15ULL * (words.size() + 1);
+        for (auto word : words)
+            h = mix(h ^ word);
+        return h ? h : 1;
+    }
+
+    // The fingerprint the interpreter gives node's expr (see make_expr in
+    // its engine.cpp), with refs numbered the way its parser does, into
+    // ref; the bodies of the lambdas on the way go to body_fps. lmb
+    // --memo-policy writes lambda bodies by these.
+    uint64_t __body_fp(node_hdr_t _node, std::map<std::string, size_t> &ref) {
+
+        if (auto node = std::dynamic_pointer_cast<term_node_t>(_node)) {
+            if (!ref.count(node->ident))
+                ref.insert(std::make_pair(node->ident, ref.size()));
+            return __fingerprint({'r', ref[node->ident]});
+        }
+
+        if (auto node = std::dynamic_pointer_cast<apply_node_t>(_node)) {
+            uint64_t func = __body_fp(node->nd_fun, ref);
+            uint64_t arg = __body_fp(node->nd_arg, ref);
+            return __fingerprint({'a', func, arg});
+        }
+
+        auto node = std::dynamic_pointer_cast<lmb_node_t>(_node);
+        assert(node);
+        std::map<std::string, size_t> nref{{node->arg, 0}};
+        uint64_t body = body_fps[node.get()] = __body_fp(node->nd_body, nref);
+
+        nref.erase(node->arg);
+        std::vector<uint64_t> words(nref.size() + 2);
+        words[0] = 'l', words[1] = body;
+        for (auto pair : nref) {
+            if (!ref.count(pair.first))
+                ref.insert(std::make_pair(pair.first, ref.size()));
+            words[pair.second + 1] = ref[pair.first];
+        }
+        return __fingerprint(words);
+    }
+
     void __extract_static_lmb(std::shared_ptr<code_lmb_t> lmb, std::map<code_id_t, std::shared_ptr<code_lmb_t>> alias={}, const std::map<code_id_t, code_id_t> &env_map={}) {
 
         std::vector<code_inst_t> ninsts;
@@ -431,6 +899,192 @@ struct transpiler_t::impl_t {
         }
     }
 
+    // Whether closures of lmb can reach a builtin through their code (on
+    // top of what their env reaches), and whether lmb surely applies its
+    // argument: it calls it, or passes it to a static lmb that does. Every
+    // inst of a body runs, so one such inst is enough. lmbs come
+    // dependencies first.
+    void __analyze_lmb(std::shared_ptr<code_lmb_t> lmb, std::map<code_id_t, std::shared_ptr<code_lmb_t>> &statics) {
+
+        auto reaches = [&](code_id_t id) {
+            return builtin_ids.count(id) || (id.type == code_id_t::GLOBAL && lmb_effects[statics[id]]);
+        };
+
+        bool effects = reaches(lmb->body.retv);
+        bool strict = false;
+        for (auto &inst : lmb->body.insts) {
+            if (inst.type == code_inst_t::LAMBDA) {
+                effects = effects || lmb_effects[inst.lmb];
+                continue;
+            }
+            effects = effects || reaches(inst.func) || reaches(inst.arg);
+            if (inst.func == arg_id())
+                strict = true;
+            if (inst.arg == arg_id() && inst.func.type == code_id_t::GLOBAL && !builtin_ids.count(inst.func))
+                strict = strict || lmb_strict[statics[inst.func]];
+        }
+
+        lmb_effects[lmb] = effects;
+        lmb_strict[lmb] = strict;
+    }
+
+    // Lazy code: the insts computing an argument, and only it, right before
+    // the application, go into a thunk the callee forces if it needs the
+    // value. The generated code still runs them in place when the callee is
+    // strict or something they use may do I/O, so effects keep their order.
+    void __defer_args(std::shared_ptr<code_lmb_t> prog) {
+
+        std::vector<std::shared_ptr<code_lmb_t>> order;
+        std::set<std::shared_ptr<code_lmb_t>> emited;
+        __order(prog, order, emited);
+
+        std::map<code_id_t, std::shared_ptr<code_lmb_t>> statics;
+        for (auto lmb : order)
+            statics[lmb->name] = lmb;
+        for (auto lmb : order)
+            __analyze_lmb(lmb, statics);
+        for (auto lmb : order)
+            __defer_args(lmb, statics);
+    }
+
+    void __defer_args(std::shared_ptr<code_lmb_t> lmb, std::map<code_id_t, std::shared_ptr<code_lmb_t>> &statics) {
+
+        auto pure = [&](code_id_t id) {
+            return id.type != code_id_t::GLOBAL || (!builtin_ids.count(id) && !lmb_effects[statics[id]]);
+        };
+
+        std::map<code_id_t, int> used;
+        for (auto &inst : lmb->body.insts) {
+            used[inst.func]++;
+            used[inst.arg]++;
+            for (auto env : inst.envs)
+                used[env]++;
+        }
+        used[lmb->body.retv]++;
+
+        std::vector<code_inst_t> ninsts;
+        for (auto &inst : lmb->body.insts) {
+
+            bool known = inst.func.type == code_id_t::GLOBAL;
+            if (inst.type != code_inst_t::APPLY || inst.arg.type != code_id_t::LOCAL ||
+                (known && (builtin_ids.count(inst.func) || lmb_strict[statics[inst.func]]))) {
+                ninsts.push_back(inst);
+                continue;
+            }
+
+            // walk back over insts whose results are used by the slice only
+            std::set<code_id_t> wanted{inst.arg};
+            std::map<code_id_t, int> inner{{inst.arg, 1}};
+            size_t start = ninsts.size();
+            bool ok = true;
+            while (start > 0) {
+                auto &prev = ninsts[start - 1];
+                if (!wanted.count(prev.retv) || inner[prev.retv] != used[prev.retv] ||
+                    prev.type == code_inst_t::DEFER || prev.hoisted)
+                    break;
+                if (prev.type == code_inst_t::APPLY) {
+                    for (auto id : {prev.func, prev.arg}) {
+                        wanted.insert(id);
+                        inner[id]++;
+                        ok = ok && pure(id);
+                    }
+                } else {
+                    ok = ok && !lmb_effects[prev.lmb];
+                    for (auto env : prev.envs) {
+                        wanted.insert(env);
+                        inner[env]++;
+                    }
+                }
+                start--;
+            }
+            if (!ok || start == ninsts.size() || ninsts.back().type != code_inst_t::APPLY) {
+                ninsts.push_back(inst);
+                continue;
+            }
+
+            // the thunk, over what the slice takes from outside
+            std::vector<code_inst_t> slice(ninsts.begin() + start, ninsts.end());
+            ninsts.resize(start);
+            std::set<code_id_t> defined;
+            for (auto &sinst : slice)
+                defined.insert(sinst.retv);
+
+            std::vector<code_id_t> inputs;
+            std::map<code_id_t, code_id_t> env_map;
+            std::set<std::shared_ptr<code_lmb_t>> deps;
+            auto input = [&](code_id_t &id) {
+                if (id.type == code_id_t::GLOBAL) {
+                    if (!builtin_ids.count(id))
+                        deps.insert(statics[id]);
+                    return;
+                }
+                if (defined.count(id))
+                    return;
+                if (!env_map.count(id)) {
+                    env_map[id] = env_id(inputs.size());
+                    inputs.push_back(id);
+                }
+                id = env_map[id];
+            };
+            for (auto &sinst : slice) {
+                if (sinst.type == code_inst_t::APPLY) {
+                    input(sinst.func);
+                    input(sinst.arg);
+                } else {
+                    deps.insert(sinst.lmb);
+                    for (auto &env : sinst.envs)
+                        input(env);
+                }
+            }
+
+            code_block_t block{inst.arg, slice, deps};
+            std::shared_ptr<code_lmb_t> thunk(new code_lmb_t{next_global_id(), (int)inputs.size(), block, lmb->next_local_id, false});
+            thunks.insert(thunk);
+            lmb->body.deps.insert(thunk);
+
+            ninsts.push_back(code_inst_t{code_inst_t::DEFER, inst.arg, inst.func, none_id(), thunk, inputs, false, none_id()});
+            ninsts.push_back(inst);
+        }
+
+        lmb->body.insts = ninsts;
+    }
+
+    void __hoist_invariant_lmb(std::shared_ptr<code_lmb_t> lmb, std::set<std::shared_ptr<code_lmb_t>> &visited) {
+
+        if (visited.count(lmb))
+            return;
+        visited.insert(lmb);
+
+        for (auto dep : lmb->body.deps)
+            __hoist_invariant_lmb(dep, visited);
+
+        // a closure only capturing env / globals / other invariant closures
+        // is the same for every call of this closure, so build it once and
+        // keep it in the enclosing closure object
+        std::set<code_id_t> invariant;
+        auto is_invariant = [&](code_id_t id) {
+            return id.type == code_id_t::ENV || id.type == code_id_t::GLOBAL || invariant.count(id);
+        };
+
+        for (auto &inst : lmb->body.insts) {
+            if (inst.type != code_inst_t::LAMBDA)
+                continue;
+            inst.hoisted = true;
+            for (auto env : inst.envs)
+                if (!is_invariant(env)) {
+                    inst.hoisted = false;
+                    break;
+                }
+            if (inst.hoisted)
+                invariant.insert(inst.retv);
+        }
+    }
+
+    void __hoist_invariant_lmb(std::shared_ptr<code_lmb_t> lmb) {
+        std::set<std::shared_ptr<code_lmb_t>> visited;
+        __hoist_invariant_lmb(lmb, visited);
+    }
+
     typedef std::pair<std::shared_ptr<code_lmb_t>, std::vector<int>> code_lmb_ref_t;
     typedef std::pair<std::string, std::vector<int>> code_lmb_sig_t;
 
@@ -522,6 +1176,8 @@ struct transpiler_t::impl_t {
         auto it = sig_to_lmb.find(lmb_sig);
 
         if (it != sig_to_lmb.end()) {
+            // memoized if any of those it stands for is
+            it->second->unmemoized = it->second->unmemoized && lmb->unmemoized;
             std::vector<int> env_map(lmb->env_cnt);
             lmb_remap[lmb->name] = code_lmb_ref_t{it->second, env_ord};
         } else {
@@ -541,9 +1197,13 @@ struct transpiler_t::impl_t {
 };
 
 
-transpiler_t::transpiler_t(std::set<std::string> &_builtins)
-    : builtins(_builtins), impl(new impl_t(this)) {}
+transpiler_t::transpiler_t(std::set<std::string> &_builtins, bool _lazy, const std::set<uint64_t> &_unmemoized)
+    : builtins(_builtins), lazy(_lazy), unmemoized(_unmemoized), impl(new impl_t(this)) {}
 
 void transpiler_t::transpile(node_hdr_t node, std::ostream &stm) {
     impl->transpile(node, stm);
 }
+
+void transpiler_t::transpile(node_hdr_t node, const std::string &path, int shards) {
+    impl->transpile(node, path, shards);
+}
@@ -4,22 +4,48 @@
 #include <fstream>
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
 
 int main(int argc, char *args[]) {
 
+    // lmb_c [--shards=N] [--lazy] [--memo-policy=path] in.lmb out.cpp
+    int shards = 0;
+    bool lazy = false;
+    std::set<uint64_t> unmemoized;
+    while (argc > 1 && strncmp(args[1], "--", 2) == 0) {
+        if (strncmp(args[1], "--shards=", 9) == 0)
+            shards = atoi(args[1] + 9);
+        else if (strcmp(args[1], "--lazy") == 0)
+            lazy = true;
+        else if (strncmp(args[1], "--memo-policy=", 14) == 0) {
+            // as lmb --memo-policy writes it: a fingerprint per line
+            std::ifstream fpolicy(args[1] + 14);
+            std::string line;
+            while (std::getline(fpolicy, line))
+                if (!line.empty() && line[0] != '#')
+                    unmemoized.insert(strtoull(line.c_str(), nullptr, 16));
+        }
+        args++, argc--;
+    }
+
     assert(argc > 2);
     std::fstream fin(args[1]);
-    std::fstream fout(args[2], std::fstream::out);
+    std::fstream fout;
+    if (shards <= 0)
+        fout.open(args[2], std::fstream::out);
 
     std::set<std::string> builtins{
         "__builtin_g",
         "__builtin_p0",
         "__builtin_p1",
+        "__builtin_getbyte",
+        "__builtin_putbyte",
     };
 
     tokenizer_t tokenizer(fin);
     parser_t parser;
-    transpiler_t transpiler(builtins);
+    transpiler_t transpiler(builtins, lazy, unmemoized);
 
     while (true) {
 
@@ -38,6 +64,9 @@ int main(int argc, char *args[]) {
             break;
 
         //result.node->print();
-        transpiler.transpile(result.node, fout);
+        if (shards > 0)
+            transpiler.transpile(result.node, args[2], shards);
+        else
+            transpiler.transpile(result.node, fout);
     }
 }
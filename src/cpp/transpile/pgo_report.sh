@@ -0,0 +1,26 @@
+#!/bin/bash
+# pgo_report.sh plain pgo in...
+# best of 3 wall times of both builds on each input, after checking
+# that they print the same
+set -u
+plain=$1 pgo=$2
+shift 2
+ulimit -s unlimited
+TIMEFORMAT=%R
+
+best() {
+    for _ in 1 2 3; do
+        { time "$1" < "$2" > /dev/null; } 2>&1
+    done | sort -n | head -1
+}
+
+printf '%-24s %10s %10s %8s\n' input plain pgo speedup
+for f in "$@"; do
+    if ! cmp -s <("$plain" < "$f") <("$pgo" < "$f"); then
+        echo "$f: outputs differ" >&2
+        exit 1
+    fi
+    awk -v name="$(basename "$f")" -v a="$(best "$plain" "$f")" -v b="$(best "$pgo" "$f")" \
+        'BEGIN { printf "%-24s %9.3fs %9.3fs %7.2fx\n", name, a, b, (b > 0 ? a / b : 0) }'
+done
+printf '%-24s %10s %10s\n' size "$(stat -c %s "$plain")" "$(stat -c %s "$pgo")"